@@ -0,0 +1,85 @@
+/*
+  Deferred logging so that printf over USB is kept out of the web client servicing path.
+  Each core writes compact records (format id plus args) into its own ring,
+  which are only formatted and printed by that core when it is idle.
+  Each ring has a single producer and consumer, so head and tail only need ordered loads and stores.
+  If a ring is full, the record is dropped and counted.
+
+  s60sc 2021
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include "pico/stdlib.h"
+
+#include "PicoLog.h"
+
+typedef struct {
+  uint8_t fmtId;
+  uint32_t args[2];
+  char str[LOGSTRLEN];
+} logRecord_t;
+
+typedef struct {
+  logRecord_t records[LOGRINGLEN];
+  std::atomic<uint32_t> head; // next record to write, only updated by producer
+  std::atomic<uint32_t> tail; // next record to print, only updated by consumer
+  std::atomic<uint32_t> dropped; // records lost as ring full, only updated by producer
+  uint32_t reported; // dropped count already reported, only used by consumer
+} logRing_t;
+
+static logRing_t logRings[2]; // one per core
+
+// format strings indexed by logFmt
+static const char* const logFormats[FMT_COUNT] = {
+  "AT: %s [%lu]\n",
+  "ESP8266 busy, retry command %s [%lu]\n",
+  "Web client input: %s\n",
+  "Telemetry %s, retry in %lu secs\n",
+};
+
+static_assert((LOGRINGLEN & (LOGRINGLEN - 1)) == 0, "LOGRINGLEN must be power of 2");
+
+void __not_in_flash_func (logPush)(logFmt fmtId, const char* str1, const char* str2, uint32_t arg0, uint32_t arg1) {
+  // add record to ring for current core, or count as dropped if full
+  logRing_t* ring = &logRings[get_core_num()];
+  uint32_t head = ring->head.load(std::memory_order_relaxed);
+  if (head - ring->tail.load(std::memory_order_acquire) >= LOGRINGLEN) {
+    ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return;
+  }
+  logRecord_t* rec = &ring->records[head & (LOGRINGLEN - 1)];
+  rec->fmtId = fmtId;
+  rec->args[0] = arg0;
+  rec->args[1] = arg1;
+
+  // copy string args, separated by space, truncated to fit
+  size_t len = strnlen(str1, LOGSTRLEN - 1);
+  memcpy(rec->str, str1, len);
+  if (*str2 && len < LOGSTRLEN - 2) {
+    rec->str[len++] = ' ';
+    size_t len2 = strnlen(str2, LOGSTRLEN - 1 - len);
+    memcpy(rec->str + len, str2, len2);
+    len += len2;
+  }
+  rec->str[len] = 0;
+  ring->head.store(head + 1, std::memory_order_release); // publish record
+}
+
+void logDrain() {
+  // print any outstanding records for current core, call only when core is idle
+  logRing_t* ring = &logRings[get_core_num()];
+  uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+  uint32_t head = ring->head.load(std::memory_order_acquire);
+  while (tail != head) {
+    logRecord_t* rec = &ring->records[tail & (LOGRINGLEN - 1)];
+    printf(logFormats[rec->fmtId], rec->str, rec->args[0], rec->args[1]);
+    ring->tail.store(++tail, std::memory_order_release); // release slot
+  }
+  uint32_t dropped = ring->dropped.load(std::memory_order_relaxed);
+  if (dropped != ring->reported) {
+    printf("*** %lu log records dropped on core %u\n", (unsigned long)(dropped - ring->reported), get_core_num());
+    ring->reported = dropped;
+  }
+}
@@ -0,0 +1,35 @@
+// s60sc 2021
+
+#ifndef PICOLOG
+#define PICOLOG
+
+#include "PicoWebServer.h"
+
+// log levels, records above LOGLEVEL are removed at compile time
+enum {LOG_ERR, LOG_WARN, LOG_INFO, LOG_DBG};
+
+// format ids for deferred log records, each must have matching entry in logFormats[] in PicoLog.cpp
+// each format takes the record string as its first conversion, followed by up to 2 numeric args
+enum logFmt {
+  FMT_ATCMD,   // AT command sent
+  FMT_ATBUSY,  // ESP8266 busy, command retried
+  FMT_WEBIN,   // web client request received
+  FMT_TELEMETRY, // telemetry batch not sent
+  FMT_COUNT
+};
+
+#define LOGRINGLEN 32 // number of records per core ring, must be power of 2
+#define LOGSTRLEN 40 // max chars of string data kept per record, excess is truncated
+
+constexpr int logLevel = LOGLEVEL;
+
+void logPush(logFmt fmtId, const char* str1, const char* str2, uint32_t arg0, uint32_t arg1);
+void logDrain();
+
+template <int level>
+inline void logMsg(logFmt fmtId, const char* str1 = "", const char* str2 = "", uint32_t arg0 = 0, uint32_t arg1 = 0) {
+  // store compact record in ring for calling core, printed later by logDrain()
+  if constexpr (level <= logLevel) logPush(fmtId, str1, str2, arg0, arg1);
+}
+
+#endif
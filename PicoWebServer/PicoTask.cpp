@@ -0,0 +1,87 @@
+/*
+  Small scheduler for cooperative coroutine tasks on core 0.
+  Tasks are started by taskSpawn() and run until they co_await a task, timer, event or yield,
+  at which point the suspended coroutine is held with its wake time until runTasks() resumes it.
+  When no task is due, the core can sleep until taskNextWake() or an interrupt.
+  So slow operations such as ESP8266 AT commands can overlap without threads or blocking.
+  Each top level task has at most one suspended coroutine waiting at a time.
+
+  s60sc 2021
+*/
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+
+#include "PicoWebServer.h"
+#include "PicoTask.h"
+
+typedef struct {
+  std::coroutine_handle<> handle;
+  absolute_time_t wakeTime;
+  taskReady_t ready; // if set, also wake when returns true
+  void* arg;
+} waitingTask_t;
+
+static std::coroutine_handle<> rootTasks[MAXTASKS]; // spawned tasks, destroyed on completion
+static waitingTask_t waitingTasks[MAXTASKS]; // suspended coroutines to be resumed
+static int waitingCount = 0;
+
+bool taskSpawn(picoTask<> task) {
+  // take ownership of task and schedule it to start
+  for (int i = 0; i < MAXTASKS; i++) {
+    if (!rootTasks[i]) {
+      rootTasks[i] = task.release();
+      taskSchedule(rootTasks[i], get_absolute_time());
+      return true;
+    }
+  }
+  puts("*** Too many tasks");
+  return false;
+}
+
+void taskSchedule(std::coroutine_handle<> handle, absolute_time_t wakeTime, taskReady_t ready, void* arg) {
+  // hold suspended coroutine until wake time reached or ready
+  if (waitingCount >= MAXTASKS) doRestart("Task scheduler overflow");
+  waitingTasks[waitingCount++] = {handle, wakeTime, ready, arg};
+}
+
+absolute_time_t taskNextWake() {
+  // earliest wake time of waiting coroutines, excluding those only waiting on an event
+  absolute_time_t nextWake = at_the_end_of_time;
+  for (int i = 0; i < waitingCount; i++) nextWake = absolute_time_min(nextWake, waitingTasks[i].wakeTime);
+  return nextWake;
+}
+
+int runTasks() {
+  // resume each coroutine due to wake, returns number resumed
+  // due coroutines taken first, so that any rescheduled by yielding wait for next call
+  std::coroutine_handle<> dueTasks[MAXTASKS];
+  int dueCount = 0;
+  for (int i = 0; i < waitingCount; ) {
+    waitingTask_t* waiting = &waitingTasks[i];
+    if (time_reached(waiting->wakeTime) || (waiting->ready && waiting->ready(waiting->arg))) {
+      dueTasks[dueCount++] = waiting->handle;
+      waitingTasks[i] = waitingTasks[--waitingCount];
+    } else i++;
+  }
+  for (int i = 0; i < dueCount; i++) dueTasks[i].resume();
+
+  // destroy completed tasks
+  for (int i = 0; i < MAXTASKS; i++) {
+    if (rootTasks[i] && rootTasks[i].done()) {
+      rootTasks[i].destroy();
+      rootTasks[i] = nullptr;
+    }
+  }
+  return dueCount;
+}
+
+picoTask<bool> taskMutexEnter(mutex_t* mtx, uint32_t timeoutMs) {
+  // acquire mutex without blocking other tasks, returns false if not obtained within timeout
+  absolute_time_t giveUp = make_timeout_time_ms(timeoutMs);
+  while (!mutex_try_enter(mtx, NULL)) {
+    if (time_reached(giveUp)) co_return false;
+    co_await taskSleep(1); // recheck each ms, so core can sleep meanwhile
+  }
+  co_return true;
+}
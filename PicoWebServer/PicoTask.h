@@ -0,0 +1,101 @@
+// s60sc 2021
+
+#ifndef PICOTASK
+#define PICOTASK
+
+#include <coroutine>
+#include <utility>
+#include "pico/stdlib.h"
+#include "pico/mutex.h"
+
+// cooperative coroutine tasks run by scheduler on core 0, see PicoTask.cpp
+#define MAXTASKS 8 // max number of concurrent top level tasks
+
+typedef bool (*taskReady_t)(void* arg);
+
+void taskSchedule(std::coroutine_handle<> handle, absolute_time_t wakeTime, taskReady_t ready = nullptr, void* arg = nullptr);
+int runTasks();
+absolute_time_t taskNextWake();
+
+template <typename T> struct taskResult {
+  // value returned by co_return
+  T value{};
+  void return_value(T val) { value = std::move(val); }
+  T result() { return std::move(value); }
+};
+
+template <> struct taskResult<void> {
+  void return_void() {}
+  void result() {}
+};
+
+template <typename T = void>
+class [[nodiscard]] picoTask {
+  // lazily started coroutine, run by co_await from another task or by taskSpawn()
+ public:
+  struct promise_type : taskResult<T> {
+    std::coroutine_handle<> continuation; // coroutine awaiting this one, if any
+
+    picoTask get_return_object() { return picoTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    struct finalAwaiter {
+      // on completion resume awaiting coroutine, otherwise remain suspended for scheduler to destroy
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+        std::coroutine_handle<> awaiting = handle.promise().continuation;
+        return awaiting ? awaiting : std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+    finalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { panic("Unhandled exception in task"); } // exceptions disabled anyway
+  };
+
+  picoTask(picoTask&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+  picoTask(const picoTask&) = delete;
+  ~picoTask() { if (handle) handle.destroy(); }
+
+  // awaiting a task starts it, and resumes awaiting coroutine with its result on completion
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+    handle.promise().continuation = awaiting;
+    return handle;
+  }
+  T await_resume() { return handle.promise().result(); }
+
+  std::coroutine_handle<> release() { return std::exchange(handle, {}); }
+
+ private:
+  explicit picoTask(std::coroutine_handle<promise_type> h) : handle(h) {}
+  std::coroutine_handle<promise_type> handle;
+};
+
+struct taskSleep {
+  // co_await taskSleep(ms) suspends calling task for at least given time
+  absolute_time_t wakeTime;
+  explicit taskSleep(uint32_t ms) : wakeTime(make_timeout_time_ms(ms)) {}
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> handle) { taskSchedule(handle, wakeTime); }
+  void await_resume() const noexcept {}
+};
+
+struct taskEvent {
+  // co_await taskEvent(ready, arg) suspends calling task until ready(arg) true or give up time reached
+  // ready() is checked each time runTasks() called, eg after core woken by interrupt
+  taskReady_t ready;
+  void* arg;
+  absolute_time_t giveUp;
+  explicit taskEvent(taskReady_t readyFunc, void* readyArg = nullptr, absolute_time_t giveUpTime = at_the_end_of_time) 
+    : ready(readyFunc), arg(readyArg), giveUp(giveUpTime) {}
+  bool await_ready() const { return ready(arg); }
+  void await_suspend(std::coroutine_handle<> handle) { taskSchedule(handle, giveUp, ready, arg); }
+  void await_resume() const noexcept {}
+};
+
+// co_await taskYield() lets other tasks run before continuing
+inline taskSleep taskYield() { return taskSleep(0); }
+
+bool taskSpawn(picoTask<> task);
+picoTask<bool> taskMutexEnter(mutex_t* mtx, uint32_t timeoutMs);
+
+#endif
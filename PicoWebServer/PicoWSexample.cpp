@@ -16,16 +16,20 @@ extern "C" {
 #include <string>
 
 #include "PicoWebServer.h"
+#include "PicoLog.h"
 #include "PicoWSpage.h"
 #include "blinkLed.pio.h"
 
 static bool setup();
 static void loop();
-static void customWebAServer(const char* url, const char* json);
-static void extractJsonVal (const char* json, const char* key, char* val);
+static picoTask<> webClientTask();
+static picoTask<> customWebAServer(const webRequest_t* request);
+static void extractJsonVal (const char* json, const char* key, char* val, size_t valSize);
 static void configESP8266gpio();
 static void configPico();
-static void pollESP8266gpio(int64_t pollTime);
+static picoTask<> pollESP8266task(uint32_t pollSecs);
+static picoTask<> sampleTask(uint32_t sampleSecs);
+static float readTemperature();
 
 static float gotVolt = 0;
 
@@ -50,39 +54,39 @@ static bool setup() {
   configPico();
   blinkLed(BLINKRATE); // using PIO
   sleep_ms(1000); // ensure core0 setup finished before start core1
-  return startWebServer();
+  if (!startWebServer()) return false;
+
+  // app handlers and periodic jobs run as tasks on core 0
+  taskSpawn(webClientTask());
+  taskSpawn(pollESP8266task(5)); // poll per 5 seconds
+  taskSpawn(sampleTask(1)); // sample per second
+  taskSpawn(telemetryTask()); // send samples in batches
+  return true;
 }
 
 static void loop() {
+  // run any tasks due, otherwise idle
+  if (!runTasks()) {
+    logDrain(); // idle, so output deferred logging
+    sleepUntilEvent(taskNextWake()); // until next task timer or interrupt
+  }
+}
+
+static picoTask<> webClientTask() {
   // check for web client input from core 1
-  uintptr_t* webIn = webInput();
-  if (webIn) {
-    // got input
-    char* webInStr = (char*)webIn;
-    int32_t webInLen = strlen(webInStr); 
-
-    //  extract url and json from received data
-    int urlLen = webInLen;
-    int jsonLen = 0;
-    char* jsonSep = strstr(webInStr,","); 
-    if (jsonSep != NULL) {
-      // have json data after first comma
-      urlLen = jsonSep - webInStr;
-      jsonLen = webInLen - urlLen;
-    } 
-    char url[urlLen+1] = {0};
-    strncpy(url, webInStr, urlLen);
-    char json[jsonLen+1] = {0};
-    strncpy(json, webInStr+urlLen+1, jsonLen);
-    customWebAServer(url, json);
-  } 
-  pollESP8266gpio(5); // poll per 5 seconds
+  while (true) {
+    co_await taskEvent([](void*) { return webInput() != nullptr; }); // woken by core 1 interrupt
+    // got input, already parsed into url, query, headers and body
+    co_await customWebAServer(webInput());
+  }
 }
 
 /* ----------------------- user customised functions ----------------------------- */
 
-static void customWebAServer(const char* url, const char* jsonIn) {
-  // setup custom web server
+static picoTask<> customWebAServer(const webRequest_t* request) {
+  // setup custom web server, can co_await other tasks before calling appResponse()
+  const char* url = request->path.ptr;
+  const char* jsonIn = request->body.ptr;
   static char jsonOut[100]; // buffer to holde json response
   static float blinkRate = BLINKRATE;
   // switch on url value to build and return response to core1
@@ -91,8 +95,8 @@ static void customWebAServer(const char* url, const char* jsonIn) {
   }
   else if (strcmp(url, "/update") == 0)  {
     // blink value is key 4
-    char blinkValStr[strlen(jsonIn)+1] = {0};
-    extractJsonVal(jsonIn, "\"4\":", blinkValStr);
+    char blinkValStr[16] = {0};
+    extractJsonVal(jsonIn, "\"4\":", blinkValStr, sizeof(blinkValStr));
     blinkRate = strtof(blinkValStr, nullptr);
     blinkLed(blinkRate);
     appResponse(""); // send 200 OK
@@ -100,11 +104,41 @@ static void customWebAServer(const char* url, const char* jsonIn) {
   else if (strcmp(url, "/refresh") == 0)  {
     // obtain and build json output
     getTOD(); // get latest time and date
-    // get internal temp, 12-bit conversion, assume max value is ADC_VREF @ 3V3
-    float temperature = 27.0 - ((adc_read() * 3.3 / 4096.0) - 0.706) / 0.001721;
-    sprintf(jsonOut, "{\"1\":\"%s\",\"2\":\"%0.1fC\",\"3\":\" %0.4fV\",\"4\":\"%0.2f\"}", datetimeStr, temperature,  gotVolt, blinkRate);
+    sprintf(jsonOut, "{\"1\":\"%s\",\"2\":\"%0.1fC\",\"3\":\" %0.4fV\",\"4\":\"%0.2f\"}", datetimeStr, readTemperature(),  gotVolt, blinkRate);
     appResponse(jsonOut); 
   }
+  else if (strcmp(url, "/stats") == 0)  {
+    // health and throughput of each ESP8266 as json array
+    static char statsOut[120 * ESPCOUNT + 3]; // each entry up to 114 chars when all counters have 10 digits
+    int statsLen = snprintf(statsOut, sizeof(statsOut), "[");
+    espStats_t stats;
+    for (int i = 0; getESP8266stats(i, &stats); i++) 
+      statsLen += snprintf(statsOut+statsLen, sizeof(statsOut)-statsLen, "%s{\"healthy\":%u,\"serving\":%u,\"requests\":%lu,\"bytesSent\":%lu,\"atErrors\":%lu,\"outages\":%lu}", 
+        i ? "," : "", stats.healthy, stats.serving, stats.requests, stats.bytesSent, stats.atErrors, stats.outages);
+    snprintf(statsOut+statsLen, sizeof(statsOut)-statsLen, "]");
+    appResponse(statsOut); 
+  }
+  else if (strcmp(url, "/wakestats") == 0)  {
+    // sleep time and wake latency of each core as json array
+    static char wakeOut[200]; // each entry up to 90 chars when all counters have 10 digits
+    int wakeLen = snprintf(wakeOut, sizeof(wakeOut), "[");
+    wakeStats_t stats;
+    for (uint core = 0; getWakeStats(core, &stats); core++) 
+      wakeLen += snprintf(wakeOut+wakeLen, sizeof(wakeOut)-wakeLen, "%s{\"wakes\":%lu,\"avgLatencyUs\":%lu,\"maxLatencyUs\":%lu,\"sleepPct\":%0.1f}", 
+        core ? "," : "", stats.wakes, stats.wakes ? (uint32_t)(stats.totalLatencyUs / stats.wakes) : 0, stats.maxLatencyUs, 
+        stats.sleepUs * 100.0 / time_us_64());
+    snprintf(wakeOut+wakeLen, sizeof(wakeOut)-wakeLen, "]");
+    appResponse(wakeOut); 
+  }
+  else if (strcmp(url, "/telemetry") == 0)  {
+    // outbound telemetry progress as json
+    static char telemetryOut[150]; // up to 127 chars when all counters have 10 digits
+    telemetryStats_t stats;
+    getTelemetryStats(&stats);
+    snprintf(telemetryOut, sizeof(telemetryOut), "{\"samples\":%lu,\"dropped\":%lu,\"batches\":%lu,\"sent\":%lu,\"failures\":%lu,\"deferred\":%lu}", 
+      stats.samples, stats.dropped, stats.batches, stats.sent, stats.failures, stats.deferred);
+    appResponse(telemetryOut); 
+  }
   else if (strcmp(url, "/reset") == 0)  {
     // force reset
     watchdog_reboot(0, 0, 0); 
@@ -112,14 +146,17 @@ static void customWebAServer(const char* url, const char* jsonIn) {
   else {
     appResponse(""); // url not found (send 200, but should send 404)
   }
+  co_return;
 }
 
-static void extractJsonVal (const char* json, const char* key, char* val) {
+static void extractJsonVal (const char* json, const char* key, char* val, size_t valSize) {
   // dirty way to obtain value for supplied key in json
-  char* s = strstr(json, key);   
+  const char* s = strstr(json, key);   
+  if (s == NULL) return; // key not present
   s += strlen(key) + 1; // skip over opening "
-  char* e = strstr(s, "\""); // value bounded by closing "
-  strncpy(val, s, e-s); 
+  const char* e = strstr(s, "\""); // value bounded by closing "
+  if (e == NULL) return; // no closing "
+  strncpy(val, s, ((size_t)(e-s) < valSize) ? e-s : valSize-1); 
 }
 
 static void configPico() {
@@ -129,25 +166,35 @@ static void configPico() {
   adc_select_input(4); // internal adc
 }
 
+static float readTemperature() {
+  // get internal temp, 12-bit conversion, assume max value is ADC_VREF @ 3V3
+  return 27.0 - ((adc_read() * 3.3 / 4096.0) - 0.706) / 0.001721;
+}
+
 static void configESP8266gpio() {
   // configure any required ESP8266 gpio pins
   ESP8266pinMode(2, ESP_OUTPUT, ESP_NOPULLUP);
   ESP8266pinMode(14, ESP_INPUT, ESP_NOPULLUP);
 }
 
-static void pollESP8266gpio(int64_t pollTime) {
+static picoTask<> pollESP8266task(uint32_t pollSecs) {
   // set or get any required ESP8266 gpio pins 
-  // usage should not be time critical
-  pollTime *= MICROS; // convert to micro secs
-  static bool toggle = false;
-  static absolute_time_t start = get_absolute_time();
-
-  if (absolute_time_diff_us(start, get_absolute_time()) > pollTime) {
-    start = get_absolute_time();
-    if (ESP8266digitalWrite(2, toggle)) toggle = !toggle; // blink ESP8266 led at polling rate
-    int gotDigi = ESP8266digitalRead(14);
-    float adcVal = ESP8266analogRead(); 
+  // runs alongside web client servicing as waits on ESP8266 do not block other tasks
+  bool toggle = false;
+  while (true) {
+    co_await taskSleep(pollSecs * 1000);
+    if (co_await ESP8266digitalWriteAsync(2, toggle)) toggle = !toggle; // blink ESP8266 led at polling rate
+    int gotDigi = co_await ESP8266digitalReadAsync(14);
+    float adcVal = co_await ESP8266analogReadAsync(); 
     if (adcVal >= 0) gotVolt = adcVal;
   }
 }
 
+static picoTask<> sampleTask(uint32_t sampleSecs) {
+  // buffer readings for outbound telemetry, sent in batches by telemetryTask()
+  while (true) {
+    co_await taskSleep(sampleSecs * 1000);
+    telemetryAdd(1, readTemperature());
+    telemetryAdd(2, gotVolt);
+  }
+}
@@ -0,0 +1,20 @@
+// s60sc 2021
+
+#ifndef PICOWSFILES
+#define PICOWSFILES
+
+// read only files held in flash, generated at build time from content of data directory by mkWebFiles.cmake
+typedef struct {
+  const char* path; // web path, ie data directory relative name prefixed with /
+  const char* contentType;
+  const uint8_t* data; // in XIP flash
+  uint32_t len;
+  uint32_t hash; // used as ETag
+} webFile_t;
+
+#define MAXCONTENTTYPELEN 24 // longest content type set by mkWebFiles.cmake, ie application/octet-stream
+
+extern const webFile_t webFiles[];
+extern const int webFileCount;
+
+#endif
@@ -7,6 +7,7 @@ const char* index_html = R"~(
   <head>
     <meta http-equiv="Content-Type" content="text/html; charset=utf-8" />
     <title>PicoWebExample</title>
+    <link rel="icon" type="image/svg+xml" href="/favicon.svg">
     <script src="https://ajax.googleapis.com/ajax/libs/jquery/2.1.3/jquery.min.js"></script>
     <STYLE type="text/css">
       body {
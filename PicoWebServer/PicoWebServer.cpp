@@ -10,12 +10,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include "pico/stdlib.h"
 #include "hardware/gpio.h"
 #include "hardware/uart.h"
 #include "pico/multicore.h"
 #include "hardware/irq.h"
+#include "hardware/dma.h"
+#include "hardware/structs/scb.h"
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <iomanip>
 extern "C" {
 #include <hardware/rtc.h>
@@ -24,10 +29,55 @@ extern "C" {
 }
 
 #include "PicoWebServer.h"
-
-
-static char sendBuffer[SENDBUFFERLEN];
-static char responseBuffer[RESPONSEBUFFERLEN];
+#include "PicoLog.h"
+#include "PicoWSfiles.h"
+
+
+// state for each connected ESP8266
+typedef struct {
+  uart_inst_t* uart;
+  uint txPin; 
+  uint rxPin;
+  uint resetPin;
+  uint irq; // UART IRQ number
+  mutex_t mutex; // prevent both cores accessing ESP8266 at same time
+  volatile bool rxPending; // set by UART irq, cleared when serviced on core 1
+  volatile uint32_t rxTime; // time of UART irq, for wake latency
+  volatile bool clientOpen; // web client link open, so telemetry must not read ESP8266 output
+  volatile uint32_t clientOpenTime; // ms since boot when client link opened, as close may not be seen
+  char sendBuffer[SENDBUFFERLEN];
+  char responseBuffer[RESPONSEBUFFERLEN];
+  espStats_t stats;
+} esp8266_t;
+
+static esp8266_t esps[ESPCOUNT] = {
+  {.uart = uart0, .txPin = 0, .rxPin = 1, .resetPin = RESETPIN, .irq = UART0_IRQ},
+#if ESP8266MODE != 0
+  {.uart = uart1, .txPin = 4, .rxPin = 5, .resetPin = RESETPIN2, .irq = UART1_IRQ},
+#endif
+};
+// progress of AT command
+enum {AT_PENDING, AT_RETRY, AT_SUCCESS, AT_FAIL, AT_TIMEOUT};
+typedef struct {
+  const char* command;
+  const char* successMsg;
+  int64_t allowTime; // micro secs
+  absolute_time_t start;
+  bool runCommand; // command to be sent or resent
+  bool canFail; // error response expected if remote host unavailable, so not an ESP8266 fault
+  int buffPtr; // length of response so far
+  char atBuffer[SENDBUFFERLEN];
+} atCommand_t;
+
+static volatile bool failoverPending = false; // set when standby ESP8266 needs to take over
+
+static char fileHeader[256]; // HTTP header for flash file response
+// longest file response header is 206 with 10 digit numbers, excluding content type
+#define FILEHEADERMAX sizeof("HTTP/1.0 206 Partial Content\r\nAccess-Control-Allow-Origin: *\r\nETag: \"00000000\"\r\nAccept-Ranges: bytes\r\n" \
+  "Content-Type: \r\nContent-Length: 4294967295\r\nContent-Range: bytes 4294967295-4294967295/4294967295\r\n\r\n")
+static_assert(sizeof(fileHeader) >= FILEHEADERMAX + MAXCONTENTTYPELEN, "fileHeader too small for longest file response header");
+static int uartDma = -1; // DMA channel for sending response data to ESP8266, if available
+static int telemetryDma = -1; // separate DMA channel for core 0 telemetry, as may overlap with core 1 responses
 
 // HTTP response wrapper
 static const char httpHeader[] = "HTTP/1.0 200 OK\r\nAccess-Control-Allow-Origin: *\r\nHost:Pico\r\n"; 
@@ -37,89 +87,129 @@ static const char httpFooter[] = "\r\n";
 static const char serverError[] = "HTTP/1.0 500 Internal Server Error\r\n\r\n";
 
 // used for IRQs
-static uintptr_t* webIn = 0;
+static const webRequest_t* volatile webIn = 0;
 static uintptr_t* webOut = 0;
+static volatile uint32_t webInTime = 0; // time of core 0 irq, for wake latency
+static volatile bool webInSeen = false; // wake latency recorded for current request
+static wakeStats_t wakeStats[2]; // one per core
+static webRequest_t clientRequest; // current client request, views into requestBuffer
+static char requestBuffer[RESPONSEBUFFERLEN]; // copy of client request, as ESP8266 responseBuffer reused by core 0 gpio functions
 static bool webRequest = false;
 
-static mutex_t ESP8266mutex; // prevent both cores accessing ESP8266 at same time
-static mutex_t uartIrq; // gate servicing clients on uart irq 
+static semaphore_t uartIrq; // gate servicing clients on uart irq from any ESP8266
 static mutex_t core0resp; // core1 gate on response from core0
 char datetimeStr[50];
 
 // forward refs
-static bool processATcommand(const char* command, int64_t allowTime, const char* successMsg);
-static bool processATcommandOK(const char* command, int64_t allowTime);
-static int getParam(int &valOffset, const char* startStr, const char* endStr);
-static int getATdata(int buffPtr);
-static void sendResponse(const char* id);
-static bool sendResponsePart(const char* id, const char* responseData);
-static void setTOD();
+static bool processATcommand(esp8266_t* esp, const char* command, int64_t allowTime, const char* successMsg);
+static bool processATcommandOK(esp8266_t* esp, const char* command, int64_t allowTime);
+static int getParam(esp8266_t* esp, int &valOffset, const char* startStr, const char* endStr);
+static int getATdata(esp8266_t* esp, int buffPtr);
+static bool parseRequest(char* reqStart, int reqLen);
+static void sendResponse(esp8266_t* esp, const char* id);
+static bool sendResponsePart(esp8266_t* esp, const char* id, const char* responseData);
+static bool sendResponseData(esp8266_t* esp, const char* id, const uint8_t* data, uint32_t dataLen);
+static bool sendWebFile(esp8266_t* esp, const char* id);
+static void setTOD(esp8266_t* esp);
 static void core0_sio_irq() ;
-static void uartRXirq();
-static void ESP8266reset();
+static void uart0RXirq();
+static void uart1RXirq();
+static void ESP8266reset(esp8266_t* esp);
+static bool startESP8266server(esp8266_t* esp, const char* staticIP);
+static void serveClient(esp8266_t* esp);
+static void startStandby();
+static void ESP8266failed(esp8266_t* esp, const char* fatalMsg);
+static void recordWake(uint32_t eventTime);
+static void writeUartData(esp8266_t* esp, int dmaChan, const uint8_t* data, uint32_t dataLen);
+static const char* clientLinkEvent(esp8266_t* esp, const char* event);
+static void setClientOpen(esp8266_t* esp, bool isOpen);
 
 /* ----------------------------- uart and cores setup -------------------------------- */
 
 void setupUART() {
-  // Initialise UART 0
-  uart_set_format(uart0, 8, 1, UART_PARITY_NONE);
-  uart_init(uart0, 115200); // default ESP8266 baud rate
-  // Set the GPIO pin mux to the UART - 0 is TX, 1 is RX
-  gpio_set_function(0, GPIO_FUNC_UART);
-  gpio_set_function(1, GPIO_FUNC_UART);
-
-  // ESP8266 reset pin
-  gpio_init(RESETPIN);
-  gpio_set_dir(RESETPIN, GPIO_OUT);
-  ESP8266reset();
-
-  // use mutexes to control access
-  mutex_init(&ESP8266mutex);
+  // initialise UART for each ESP8266
+  for (esp8266_t* esp = esps; esp < esps+ESPCOUNT; esp++) {
+    uart_set_format(esp->uart, 8, 1, UART_PARITY_NONE);
+    uart_init(esp->uart, 115200); // default ESP8266 baud rate
+    // Set the GPIO pin mux to the UART - uart0 on 0 (TX) and 1 (RX), uart1 on 4 (TX) and 5 (RX)
+    gpio_set_function(esp->txPin, GPIO_FUNC_UART);
+    gpio_set_function(esp->rxPin, GPIO_FUNC_UART);
+
+    // ESP8266 reset pin
+    gpio_init(esp->resetPin);
+    gpio_set_dir(esp->resetPin, GPIO_OUT);
+    ESP8266reset(esp);
+
+    // use mutex to control access
+    mutex_init(&esp->mutex);
+  }
+
+  // use mutex and semaphore to gate cores
   mutex_init(&core0resp); 
-  mutex_init(&uartIrq);
-  mutex_try_enter(&uartIrq, NULL); // start off blocked
+  sem_init(&uartIrq, 0, 1); // start off blocked
   mutex_try_enter(&core0resp, NULL); 
 
-  // Set up UART to use RX interrupt
-  irq_set_exclusive_handler(UART0_IRQ, uartRXirq);
-  irq_set_enabled(UART0_IRQ, true);
+  // DMA used to send response data from flash or RAM to UART without copying
+  uartDma = dma_claim_unused_channel(false);
+  telemetryDma = dma_claim_unused_channel(false);
+
+  // Set up UARTs to use RX interrupt, only enabled on core 1 which services clients
+  irq_set_exclusive_handler(UART0_IRQ, uart0RXirq);
+  if (ESPCOUNT > 1) irq_set_exclusive_handler(UART1_IRQ, uart1RXirq);
+
+  // pending interrupts wake core from WFE even when disabled, so core 0 can sleep on UART data
+  scb_hw->scr = scb_hw->scr | M0PLUS_SCR_SEVONPEND_BITS;
 
   stdio_init_all();
   rtc_init(); 
 }
 
-static void ESP8266reset() {
-  gpio_put(RESETPIN, 0);
+static void ESP8266reset(esp8266_t* esp) {
+  gpio_put(esp->resetPin, 0);
   sleep_ms(10);
-  gpio_put(RESETPIN, 1);
+  gpio_put(esp->resetPin, 1);
 }
 
 void setupESP8266() {
-  // initialise ESP8266
-  processATcommand("", 5, ""); // flush ESP8266 boot messages
-  if (processATcommandOK("GMR", 2)) {
-   // not required due to reset pin
-   // processATcommandOK("RST", 2); 
-   // processATcommand("", 5, ""); // flush ESP8266 boot messages
-    uart_puts(uart0, "ATE0\r\n"); // stop command echo;
-    processATcommandOK("", 2); // flush previous response
-
-  } else doRestart("ESP8266 not available, check connections");
+  // initialise each ESP8266
+  for (esp8266_t* esp = esps; esp < esps+ESPCOUNT; esp++) esp->stats.healthy = true; // until shown otherwise
+  for (esp8266_t* esp = esps; esp < esps+ESPCOUNT; esp++) {
+    processATcommand(esp, "", 5, ""); // flush ESP8266 boot messages
+    if (processATcommandOK(esp, "GMR", 2)) {
+     // not required due to reset pin
+     // processATcommandOK(esp, "RST", 2); 
+     // processATcommand(esp, "", 5, ""); // flush ESP8266 boot messages
+      uart_puts(esp->uart, "ATE0\r\n"); // stop command echo;
+      processATcommandOK(esp, "", 2); // flush previous response
+    } else if (esp->stats.healthy) ESP8266failed(esp, "ESP8266 not available, check connections");
+  }
 }
 
 // ISRs in RAM fro speed
-static void __not_in_flash_func (uartRXirq)() {
+static void __not_in_flash_func (uartRXirq)(esp8266_t* esp) {
   // UART RX interrupt handler
-  if (mutex_try_enter(&ESP8266mutex, NULL)) {
+  if (mutex_try_enter(&esp->mutex, NULL)) {
     // not being used for GPIOs, so can take it
-    irq_set_enabled(UART0_IRQ, false); // stop further interrupts
-    mutex_exit(&uartIrq); // open gate for client servicing
+    irq_set_enabled(esp->irq, false); // stop further interrupts
+    esp->rxTime = time_us_32();
+    esp->rxPending = true;
+    sem_release(&uartIrq); // open gate for client servicing
   }  // in use so ignore
 }
 
+static void __not_in_flash_func (uart0RXirq)() {
+  uartRXirq(&esps[0]);
+}
+
+static void __not_in_flash_func (uart1RXirq)() {
+  uartRXirq(&esps[ESPCOUNT-1]);
+}
+
 static void __not_in_flash_func (core0_sio_irq)() {
   // pointer to incoming input from core1 on interrupt
-  while (multicore_fifo_rvalid()) webIn = (uintptr_t(*)) multicore_fifo_pop_blocking();
+  while (multicore_fifo_rvalid()) webIn = (const webRequest_t*) multicore_fifo_pop_blocking();
+  webInTime = time_us_32();
+  webInSeen = false;
   multicore_fifo_clear_irq();
 }
 
@@ -133,64 +223,109 @@ static void __not_in_flash_func (core1_sio_irq)() {
 /* ----------------------------- Web Server setup -------------------------------- */
 
 bool startWebServer() {
-  // start wifi and web server on ESP8266, and get time from NTP server
+  // start wifi and web server on each serving ESP8266, and get time from NTP server
+  // in standby mode, second ESP8266 is only started if first fails
   bool isInit = false;
-  mutex_enter_blocking(&ESP8266mutex);
-  processATcommandOK("CWMODE_CUR=1", 2);
-  snprintf(sendBuffer, SENDBUFFERLEN, "CIPSTA_CUR=\"%s\",\"%s\",\"255.255.255.0\"", STATICIP, GATEWAY);
-  processATcommandOK(sendBuffer, 2); 
-  //processATcommandOK("CWLAP", 10); // list of SSIDs
-
-  snprintf(sendBuffer, SENDBUFFERLEN, "CWJAP_CUR=\"%s\",\"%s\"", WIFISSID, WIFIPASS);
-  if (processATcommandOK(sendBuffer, 10)) { 
+  for (esp8266_t* esp = esps; esp < esps+ESPCOUNT; esp++) {
+    if (!esp->stats.healthy) continue;
+    mutex_enter_blocking(&esp->mutex);
+    bool started = startESP8266server(esp, (esp == esps || ESP8266MODE == 2) ? STATICIP : STATICIP2);
+    mutex_exit(&esp->mutex);
+    if (started) {
+      isInit = true;
+      if (ESP8266MODE == 2) break; // leave standby idle
+    }
+  }
+  if (!isInit) doRestart("*** Failed to setup wifi connection");
+
+  // setup core1, and core0 IRQ
+  multicore_launch_core1(serveClients);
+  irq_set_exclusive_handler(SIO_IRQ_PROC0, core0_sio_irq);
+  irq_set_enabled(SIO_IRQ_PROC0, true);
+  return isInit;
+}
+
+static bool startESP8266server(esp8266_t* esp, const char* staticIP) {
+  // start wifi and web server on given ESP8266, getting time from NTP server if not already obtained
+  static bool haveTime = false;
+  processATcommandOK(esp, "CWMODE_CUR=1", 2);
+  snprintf(esp->sendBuffer, SENDBUFFERLEN, "CIPSTA_CUR=\"%s\",\"%s\",\"255.255.255.0\"", staticIP, GATEWAY);
+  processATcommandOK(esp, esp->sendBuffer, 2); 
+  //processATcommandOK(esp, "CWLAP", 10); // list of SSIDs
+
+  snprintf(esp->sendBuffer, SENDBUFFERLEN, "CWJAP_CUR=\"%s\",\"%s\"", WIFISSID, WIFIPASS);
+  if (processATcommandOK(esp, esp->sendBuffer, 10)) { 
     // have wifi connection
-    processATcommandOK("CIFSR", 2); 
-    snprintf(sendBuffer, SENDBUFFERLEN, "CIPSNTPCFG=1,%d,\"pool.ntp.org\"", TIMEZOME);
-    processATcommandOK(sendBuffer, 2);
-
-    // loop until get current time or timeout
-    int retries = NTPRETRIES;
-    do {
-      sleep_ms(1000);
-      // wait for response not containing 1970
-      processATcommand("CIPSNTPTIME?", 2, "");
-      if (strstr(responseBuffer, "1970") == NULL) {
-        // assume have current time if not default 1970
-        setTOD();
-        break;
-      }
-    } while (--retries);
-    if (!retries) puts("*** failed to get time from NTP");
+    processATcommandOK(esp, "CIFSR", 2); 
+    if (!haveTime) {
+      snprintf(esp->sendBuffer, SENDBUFFERLEN, "CIPSNTPCFG=1,%d,\"pool.ntp.org\"", TIMEZOME);
+      processATcommandOK(esp, esp->sendBuffer, 2);
+
+      // loop until get current time or timeout
+      int retries = NTPRETRIES;
+      do {
+        sleep_ms(1000);
+        // wait for response not containing 1970
+        processATcommand(esp, "CIPSNTPTIME?", 2, "");
+        if (strstr(esp->responseBuffer, "1970") == NULL) {
+          // assume have current time if not default 1970
+          setTOD(esp);
+          haveTime = true;
+          break;
+        }
+      } while (--retries);
+      if (!retries) puts("*** failed to get time from NTP");
+    }
 
     // start web server
-    processATcommandOK("CIPMUX=1", 2); 
-    processATcommandOK("CIPSERVERMAXCONN=1", 2); // for simplicity, only one concurrent connection
-    processATcommandOK("CIPSERVER=1,80", 2); 
-    processATcommandOK("SYSRAM?", 2); // available RAM on ESP8266 
+    processATcommandOK(esp, "CIPMUX=1", 2); 
+    processATcommandOK(esp, "CIPSERVERMAXCONN=1", 2); // for simplicity, only one concurrent connection
+    processATcommandOK(esp, "CIPSERVER=1,80", 2); 
+    snprintf(esp->sendBuffer, SENDBUFFERLEN, "CIPSTO=%u", CLIENTTIMEOUT);
+    processATcommandOK(esp, esp->sendBuffer, 2); // idle client link closed by ESP8266 after this time
+    processATcommandOK(esp, "SYSRAM?", 2); // available RAM on ESP8266 
+    logDrain(); // output setup logging before server starts
     getTOD(); // get current time
-    printf("\nWeb server available on %s at %s\n\n", STATICIP, datetimeStr);
-
-    // setup core1, and core0 IRQ
-    multicore_launch_core1(serveClients);
-    irq_set_exclusive_handler(SIO_IRQ_PROC0, core0_sio_irq);
-    irq_set_enabled(SIO_IRQ_PROC0, true);
-    uart_set_irq_enables(uart0, true, false);
-    isInit = true;
-  } else doRestart("*** Failed to setup wifi connection");
+    printf("\nWeb server available on %s at %s\n\n", staticIP, datetimeStr);
+    uart_set_irq_enables(esp->uart, true, false);
+    esp->stats.serving = true;
+    return true;
+  } 
+  ESP8266failed(esp, "*** Failed to setup wifi connection");
+  return false;
+}
 
-  mutex_exit(&ESP8266mutex);
-  return isInit;
+static void ESP8266failed(esp8266_t* esp, const char* fatalMsg) {
+  // ESP8266 not usable, restart unless another ESP8266 can continue serving
+  bool wasServing = esp->stats.serving;
+  esp->stats.healthy = esp->stats.serving = false;
+  esp->stats.outages++;
+  bool otherOK = false;
+  for (esp8266_t* other = esps; other < esps+ESPCOUNT; other++) 
+    if (other != esp && other->stats.healthy) otherOK = true;
+  if (!otherOK) doRestart(fatalMsg);
+
+  // hold in reset so that it leaves network and stops interrupting
+  printf("*** ESP8266 %u taken out of service: %s\n", (uint)(esp-esps), fatalMsg);
+  irq_set_enabled(esp->irq, false);
+  uart_set_irq_enables(esp->uart, false, false);
+  gpio_put(esp->resetPin, 0);
+  if (ESP8266MODE == 2 && wasServing) {
+    // get core 1 to start standby ESP8266 with same IP
+    failoverPending = true;
+    sem_release(&uartIrq);
+  }
 }
 
-static void setTOD () {
+static void setTOD(esp8266_t* esp) {
   // set current system time and date
   datetime_t dt;
 
   // extract received time value
   int todOffset = 0;
-  int todLen = getParam(todOffset, ":", "\r");
+  int todLen = getParam(esp, todOffset, ":", "\r");
   char tod[todLen+1] = {0};
-  strncpy(tod, responseBuffer+todOffset, todLen);
+  strncpy(tod, esp->responseBuffer+todOffset, todLen);
 
   // update RTC with NTP time
   std::tm t = {};
@@ -222,113 +357,363 @@ void serveClients() {
   multicore_fifo_clear_irq();
   irq_set_exclusive_handler(SIO_IRQ_PROC1, core1_sio_irq);
   irq_set_enabled(SIO_IRQ_PROC1, true);
+  scb_hw->scr = scb_hw->scr | M0PLUS_SCR_SEVONPEND_BITS; // wake from WFE on UART data while its irq disabled
+  for (esp8266_t* esp = esps; esp < esps+ESPCOUNT; esp++) irq_set_enabled(esp->irq, true);
 
   while (true) {
     // handle incoming web client requests, gate on interrupt
-    mutex_enter_blocking(&uartIrq);
-      if (uart_is_readable(uart0)) {
-        processATcommand("", 2, "");
-        // request available
-        if (strstr(responseBuffer, "+IPD") != NULL) {
-
-          // +IPD,<link	ID>,<len>:<method> <path> HTTP/1.1
-          // received client request, get client id
-          int valOffset = 0;
-          int valLen = getParam(valOffset, "+IPD,", ","); 
-          char id[valLen+1] = {0};
-          strncpy(id, responseBuffer+valOffset, valLen);
-
-          // get length of data to return
-          valOffset += valLen;
-          valLen = getParam(valOffset, ",", ":"); 
-          char reqLen[valLen+1] = {0};
-          strncpy(reqLen, responseBuffer+valOffset, valLen);
-          int requestLen = atoi(reqLen);
-
-          // received payload, so process response   
-          if (strlen(responseBuffer) > requestLen) sendResponse(id);       
-          else {
-            printf("expected %u, got %u: %s\n", requestLen, strlen(responseBuffer), responseBuffer);
-            doRestart(" ");
-          }
-        }  // unexpected content, ignore
+    logDrain(); // idle until next request, so output deferred logging
+    uint64_t sleepStart = time_us_64();
+    sem_acquire_blocking(&uartIrq); // sleeps in WFE until released by UART irq
+    wakeStats[1].sleepUs += time_us_64() - sleepStart;
+    if (failoverPending) startStandby();
+    // service each ESP8266 that raised interrupt
+    for (esp8266_t* esp = esps; esp < esps+ESPCOUNT; esp++) {
+      if (!esp->rxPending) continue;
+      esp->rxPending = false;
+      recordWake(esp->rxTime);
+      if (esp->stats.healthy && uart_is_readable(esp->uart)) serveClient(esp);
+      mutex_exit(&esp->mutex); // allow gpios
+      if (esp->stats.healthy) irq_set_enabled(esp->irq, true); // reenable interrupts
     }
-    mutex_exit(&ESP8266mutex); // allow gpios
-    irq_set_enabled(UART0_IRQ, true); // reenable interrupts
   }
 }
 
-static void sendResponse(const char* id) {
-  // build response to client request
-  // extract whether GET or POST
-  int valOffset = 0;
-  int valLen = getParam(valOffset, ":", " "); 
-  char method[valLen+1] = {0};
-  strncpy(method, responseBuffer+valOffset, valLen);
+static void serveClient(esp8266_t* esp) {
+  // handle web client request received by given ESP8266
+  processATcommand(esp, "", 2, "");
+  // request available
+  if (strstr(esp->responseBuffer, "+IPD") != NULL) {
+
+    // +IPD,<link	ID>,<len>:<method> <path> HTTP/1.1
+    // received client request, get client id
+    int valOffset = 0;
+    int valLen = getParam(esp, valOffset, "+IPD,", ","); 
+    char id[valLen+1] = {0};
+    strncpy(id, esp->responseBuffer+valOffset, valLen);
+    if (atoi(id) == TELEMETRYLINK) return; // late response from telemetry collector, not a client request
+    setClientOpen(esp, true);
+
+    // get length of data to return
+    valOffset += valLen;
+    valLen = getParam(esp, valOffset, ",", ":"); 
+    char reqLen[valLen+1] = {0};
+    strncpy(reqLen, esp->responseBuffer+valOffset, valLen);
+    int requestLen = atoi(reqLen);
+    esp->stats.requests++;
+
+    // received payload, so process response   
+    if (strlen(esp->responseBuffer) > requestLen) {
+      // request starts after colon, limit to data actually received
+      int reqOffset = valOffset + valLen + 1;
+      int reqAvail = strlen(esp->responseBuffer) - reqOffset;
+      int reqCopy = (requestLen < reqAvail) ? requestLen : reqAvail;
+      memcpy(requestBuffer, esp->responseBuffer+reqOffset, reqCopy);
+      if (parseRequest(requestBuffer, reqCopy)) {
+        // serve from flash file store if present, otherwise pass to app on core 0
+        if (!sendWebFile(esp, id)) sendResponse(esp, id);
+      } else {
+        snprintf(esp->sendBuffer, SENDBUFFERLEN, "CIPCLOSE=%s", id);
+        processATcommandOK(esp, esp->sendBuffer, 2); // malformed request, drop it
+      }
+    } else {
+      printf("expected %u, got %u: %s\n", requestLen, strlen(esp->responseBuffer), esp->responseBuffer);
+      ESP8266failed(esp, " ");
+    }
+    setClientOpen(esp, false); // link closed after response
+  } else {
+    // track client link between connecting and sending request, so that telemetry waits
+    // latest event applies, as link may connect and close within same response, eg browser preconnect
+    const char* connected = clientLinkEvent(esp, ",CONNECT");
+    const char* closed = clientLinkEvent(esp, ",CLOSED");
+    if (connected != NULL && (closed == NULL || connected > closed)) setClientOpen(esp, true);
+    else if (closed != NULL) setClientOpen(esp, false);
+  }  // otherwise unexpected content, ignore
+}
 
-  // extract URL
-  int urlOffset = valOffset + valLen;
-  int urlLen = getParam(urlOffset, " ", " HTTP"); 
-  
-  int jsonOffset = urlOffset + urlLen;
-  int jsonLen = 0;
-  // for POST, also need form content (json)
-  if (strncmp(method, "POST", 4) == 0) jsonLen = getParam(jsonOffset, "\r\n\r\n{", "}"); 
-    
-  char core0msg[urlLen+jsonLen+2] = {0};   
-  strncpy(core0msg, responseBuffer+urlOffset, urlLen);
-  if (jsonLen > 0) {
-    strcat (core0msg, ",");
-    strncat (core0msg, responseBuffer+jsonOffset, jsonLen);
-  }
-  printf("Web client input: %s %s\n", method, core0msg);
+static const char* clientLinkEvent(esp8266_t* esp, const char* event) {
+  // last web client event in ESP8266 output such as "<id>,CONNECT", ignoring telemetry link, or NULL if none
+  const char* found = NULL;
+  for (const char* p = esp->responseBuffer; (p = strstr(p, event)) != NULL; p++) 
+    if (p > esp->responseBuffer && isdigit(p[-1]) && p[-1] - '0' != TELEMETRYLINK) found = p;
+  return found;
+}
+
+static void setClientOpen(esp8266_t* esp, bool isOpen) {
+  esp->clientOpenTime = to_ms_since_boot(get_absolute_time());
+  esp->clientOpen = isOpen;
+}
+
+static bool clientLinkOpen(esp8266_t* esp) {
+  // web client link open, unless ESP8266 will have closed it as idle without close being seen
+  return esp->clientOpen && to_ms_since_boot(get_absolute_time()) - esp->clientOpenTime < CLIENTTIMEOUT * 1000;
+}
+
+static void startStandby() {
+  // standby ESP8266 takes over IP of failed ESP8266
+  failoverPending = false;
+  esp8266_t* esp = &esps[ESPCOUNT-1];
+  if (!esp->stats.healthy || esp->stats.serving) return;
+  printf("*** Failover to standby ESP8266 %u\n", (uint)(esp-esps));
+  mutex_enter_blocking(&esp->mutex);
+  startESP8266server(esp, STATICIP);
+  mutex_exit(&esp->mutex);
+}
+
+static char* cutToken(char* &str, const char* sep) {
+  // terminate token at separator and advance past it, returns start of token or NULL if separator not found
+  char* e = strstr(str, sep);
+  if (e == NULL) return NULL;
+  char* token = str;
+  *e = 0;
+  str = e + strlen(sep);
+  return token;
+}
+
+static strView_t decodeView(char* str, bool isQuery) {
+  // percent decode string in place, as decoded string never longer than encoded
+  char* out = str;
+  for (char* in = str; *in; in++) {
+    if (*in == '+' && isQuery) *out++ = ' ';
+    else if (*in == '%' && isxdigit(in[1]) && isxdigit(in[2])) {
+      char hex[3] = {in[1], in[2], 0};
+      *out++ = (char)strtol(hex, NULL, 16);
+      in += 2;
+    } else *out++ = *in;
+  }
+  *out = 0;
+  return {str, (int)(out - str)};
+}
+
+static bool parseRequest(char* reqStart, int reqLen) {
+  // parse client request once, in place in requestBuffer, into clientRequest for core 0
+  // <method> <path>?<query> HTTP/1.1\r\n<headers>\r\n\r\n<body>
+  static const strView_t emptyView = {"", 0};
+  clientRequest.paramCount = 0;
+  clientRequest.path = clientRequest.ifNoneMatch = clientRequest.range = clientRequest.acceptEncoding = clientRequest.contentType = clientRequest.body = emptyView;
+  clientRequest.contentLength = -1;
+  reqStart[reqLen] = 0; // exclude any following ESP8266 output
+  char* reqPtr = reqStart;
+
+  // request line
+  char* method = cutToken(reqPtr, " ");
+  char* target = cutToken(reqPtr, " ");
+  if (method == NULL || target == NULL || cutToken(reqPtr, "\r\n") == NULL) return false;
+  if (strcmp(method, "GET") == 0) clientRequest.method = HTTP_GET;
+  else if (strcmp(method, "POST") == 0) clientRequest.method = HTTP_POST;
+  else if (strcmp(method, "HEAD") == 0) clientRequest.method = HTTP_HEAD;
+  else if (strcmp(method, "PUT") == 0) clientRequest.method = HTTP_PUT;
+  else if (strcmp(method, "DELETE") == 0) clientRequest.method = HTTP_DELETE;
+  else clientRequest.method = HTTP_OTHER;
+
+  // split query string into key value pairs
+  char* query = strchr(target, '?');
+  if (query != NULL) {
+    *query++ = 0;
+    while (*query && clientRequest.paramCount < MAXQUERYPARAMS) {
+      char* param = query;
+      char* amp = strchr(query, '&');
+      if (amp != NULL) {
+        *amp = 0;
+        query = amp + 1;
+      } else query += strlen(query);
+      char* eq = strchr(param, '=');
+      if (eq != NULL) *eq++ = 0;
+      clientRequest.paramKeys[clientRequest.paramCount] = decodeView(param, true);
+      clientRequest.paramVals[clientRequest.paramCount++] = (eq != NULL) ? decodeView(eq, true) : emptyView;
+    }
+  }
+  clientRequest.path = decodeView(target, false);
+  logMsg<LOG_INFO>(FMT_WEBIN, method, clientRequest.path.ptr);
+
+  // extract selected headers, until blank line before body
+  char* line;
+  while ((line = cutToken(reqPtr, "\r\n")) != NULL && *line) {
+    char* val = strchr(line, ':');
+    if (val == NULL) continue;
+    *val++ = 0;
+    while (*val == ' ') val++;
+    strView_t view = {val, (int)strlen(val)};
+    if (strcasecmp(line, "If-None-Match") == 0) clientRequest.ifNoneMatch = view;
+    else if (strcasecmp(line, "Range") == 0) clientRequest.range = view;
+    else if (strcasecmp(line, "Accept-Encoding") == 0) clientRequest.acceptEncoding = view;
+    else if (strcasecmp(line, "Content-Type") == 0) clientRequest.contentType = view;
+    else if (strcasecmp(line, "Content-Length") == 0) clientRequest.contentLength = atoi(val);
+  }
+
+  // remainder is body, limited by content length if supplied
+  if (line != NULL) {
+    int bodyLen = reqStart + reqLen - reqPtr;
+    if (clientRequest.contentLength >= 0 && clientRequest.contentLength < bodyLen) bodyLen = clientRequest.contentLength;
+    reqPtr[bodyLen] = 0;
+    clientRequest.body = {reqPtr, bodyLen};
+  }
+  return true;
+}
 
+static void sendResponse(esp8266_t* esp, const char* id) {
+  // pass parsed client request to core 0 and send back its response
   // raise interrupt to send incoming request/data to main app on core 0
   if (multicore_fifo_wready()) {
-    multicore_fifo_push_blocking((uintptr_t)core0msg);
+    // release ESP8266 so that app can use its gpio functions before responding
+    mutex_exit(&esp->mutex);
+    multicore_fifo_push_blocking((uintptr_t)&clientRequest);
     // block on response from main app via interrupt
-    if (mutex_enter_timeout_ms(&core0resp, 1000*20)) {
+    bool gotResponse = mutex_enter_timeout_ms(&core0resp, 1000*20);
+    mutex_enter_blocking(&esp->mutex); // only held briefly by core 0 for each gpio function
+    if (gotResponse) {
       // have response
       char* webOutStr = (char*)webOut; 
       int webOutLeft = strlen(webOutStr);
-      int webOutStrPtr = 0;
       webOut = 0;
 
       // send response to client inside HTTP wrapper
-      if (!sendResponsePart(id, httpHeader)) return;
+      if (!sendResponsePart(esp, id, httpHeader)) return;
       // select which content type to be sent
-      bool respRes = (webOutLeft > 0 && webOutStr[0] == '{') ? sendResponsePart(id, jsonHeader) : sendResponsePart(id, contentHeader);
+      bool respRes = (webOutLeft > 0 && (webOutStr[0] == '{' || webOutStr[0] == '[')) ? sendResponsePart(esp, id, jsonHeader) : sendResponsePart(esp, id, contentHeader);
       if (!respRes) return;
 
-      // send response in chunks if too large
-      while (webOutLeft > 0) {
-        size_t packetLen =  ((webOutLeft < SENDBUFFERLEN) ? webOutLeft : SENDBUFFERLEN-1);
-        webOutLeft -= packetLen;
-        snprintf(sendBuffer, SENDBUFFERLEN, "CIPSEND=%s,%d", id, packetLen); 
-        if (processATcommand(sendBuffer, 2, ">")) { // ESP8266 ready to receive response
-          memcpy(sendBuffer, webOutStr+webOutStrPtr, packetLen);
-          webOutStrPtr += packetLen;
-          sendBuffer[packetLen] = 0; // terminate string
-          uart_puts(uart0, sendBuffer);
-          if (!processATcommandOK("", 5)) return; // confirm sent OK
-        } else return;
-      } 
+      // send response direct from app buffer
+      if (!sendResponseData(esp, id, (const uint8_t*)webOutStr, webOutLeft)) return;
 
       // closing footer
-      if (!sendResponsePart(id, httpFooter)) return;
+      if (!sendResponsePart(esp, id, httpFooter)) return;
 
     } else doRestart("core0resp blocked");
   } else doRestart("core0msg blocked");
-  snprintf(sendBuffer, SENDBUFFERLEN, "CIPCLOSE=%s", id);
-  processATcommandOK(sendBuffer, 2); // close request
+  snprintf(esp->sendBuffer, SENDBUFFERLEN, "CIPCLOSE=%s", id);
+  processATcommandOK(esp, esp->sendBuffer, 2); // close request
+}
+
+static bool sendResponsePart(esp8266_t* esp, const char* id, const char* responseData) {
+  return sendResponseData(esp, id, (const uint8_t*)responseData, strlen(responseData));
+}
+
+static bool sendResponseData(esp8266_t* esp, const char* id, const uint8_t* data, uint32_t dataLen) {
+  // send data to client in chunks if too large, data can be binary and in flash or RAM
+  while (dataLen > 0) {
+    uint32_t packetLen = (dataLen < SENDCHUNKLEN) ? dataLen : SENDCHUNKLEN;
+    snprintf(esp->sendBuffer, SENDBUFFERLEN, "CIPSEND=%s,%lu", id, (unsigned long)packetLen);
+    // check if ESP8266 ready to receive response
+    if (!processATcommand(esp, esp->sendBuffer, 2, ">")) return false;
+    writeUartData(esp, uartDma, data, packetLen);
+    // ESP8266 only confirms after all data received, so DMA will have completed
+    bool sentOK = processATcommandOK(esp, "", 5);
+    if (uartDma >= 0) dma_channel_wait_for_finish_blocking(uartDma);
+    if (!sentOK) return false;
+    esp->stats.bytesSent += packetLen;
+    data += packetLen;
+    dataLen -= packetLen;
+  }
+  return true;
+}
+
+static void writeUartData(esp8266_t* esp, int dmaChan, const uint8_t* data, uint32_t dataLen) {
+  // start sending data to ESP8266 after CIPSEND prompt, caller waits on DMA completion
+  if (dmaChan >= 0) {
+    // DMA paced by UART TX FIFO, reading directly from XIP flash or RAM
+    dma_channel_config dmaConfig = dma_channel_get_default_config(dmaChan);
+    channel_config_set_transfer_data_size(&dmaConfig, DMA_SIZE_8);
+    channel_config_set_read_increment(&dmaConfig, true);
+    channel_config_set_write_increment(&dmaConfig, false);
+    channel_config_set_dreq(&dmaConfig, uart_get_dreq(esp->uart, true));
+    dma_channel_configure(dmaChan, &dmaConfig, &uart_get_hw(esp->uart)->dr, data, dataLen, true);
+  } else uart_write_blocking(esp->uart, data, dataLen);
+}
+
+static const webFile_t* findWebFile(const char* path) {
+  // get flash file store entry for given path, or NULL if not present
+  for (int i = 0; i < webFileCount; i++) 
+    if (strcmp(webFiles[i].path, path) == 0) return &webFiles[i];
+  return NULL;
+}
+
+static int getRange(uint32_t fileLen, uint32_t &start, uint32_t &len) {
+  // apply any Range header to file, returning HTTP status code
+  // only single range supported, otherwise whole file returned
+  const char* range = clientRequest.range.ptr;
+  start = 0;
+  len = fileLen;
+  if (strncmp(range, "bytes=", 6) != 0 || strchr(range, ',') != NULL) return 200;
+  const char* spec = range + 6;
+  char* specEnd;
+  if (*spec == '-') {
+    // bytes=-<suffix len>
+    uint32_t suffixLen = strtoul(spec+1, &specEnd, 10);
+    if (specEnd == spec+1) return 200;
+    if (suffixLen == 0 || fileLen == 0) return 416;
+    if (suffixLen < fileLen) {
+      start = fileLen - suffixLen;
+      len = suffixLen;
+    }
+    return 206;
+  }
+  // bytes=<first>-[<last>]
+  uint32_t first = strtoul(spec, &specEnd, 10);
+  if (specEnd == spec || *specEnd != '-') return 200;
+  if (first >= fileLen) return 416;
+  uint32_t last = fileLen - 1;
+  spec = specEnd + 1;
+  if (*spec) {
+    uint32_t gotLast = strtoul(spec, &specEnd, 10);
+    if (specEnd == spec || gotLast < first) return 200;
+    if (gotLast < last) last = gotLast;
+  }
+  start = first;
+  len = last - first + 1;
+  return 206;
+}
+
+static void appendHeader(int &hdrLen, const char* format, ...) {
+  // append formatted text to fileHeader, hdrLen is at least buffer size if truncated
+  if (hdrLen >= (int)sizeof(fileHeader)) return;
+  va_list args;
+  va_start(args, format);
+  hdrLen += vsnprintf(fileHeader+hdrLen, sizeof(fileHeader)-hdrLen, format, args);
+  va_end(args);
 }
 
-bool sendResponsePart(const char* id, const char* responseData) {
-  snprintf(sendBuffer, SENDBUFFERLEN, "CIPSEND=%s,%d", id, strlen(responseData));
-  // check if ESP8266 ready to receive response
-  if (processATcommand(sendBuffer, 2, ">")) uart_puts(uart0, responseData); 
-  else return false;
-  return processATcommandOK("", 5); // confirm if sent OK
+static bool sendWebFile(esp8266_t* esp, const char* id) {
+  // serve requested file from flash file store, returns false if not present
+  if (clientRequest.method != HTTP_GET && clientRequest.method != HTTP_HEAD) return false;
+  const webFile_t* webFile = findWebFile(clientRequest.path.ptr);
+  if (webFile == NULL) return false;
+
+  uint32_t start = 0, len = 0;
+  char etag[11];
+  snprintf(etag, sizeof(etag), "\"%08lx\"", (unsigned long)webFile->hash);
+  int status = (strstr(clientRequest.ifNoneMatch.ptr, etag) != NULL) ? 304 : getRange(webFile->len, start, len);
+
+  // build HTTP header for status
+  int hdrLen = 0;
+  appendHeader(hdrLen, "HTTP/1.0 %s\r\nAccess-Control-Allow-Origin: *\r\nETag: %s\r\nAccept-Ranges: bytes\r\n", 
+    (status == 200) ? "200 OK" : (status == 206) ? "206 Partial Content" : (status == 304) ? "304 Not Modified" : "416 Range Not Satisfiable", etag);
+  if (status == 200 || status == 206) 
+    appendHeader(hdrLen, "Content-Type: %s\r\nContent-Length: %lu\r\n", webFile->contentType, (unsigned long)len);
+  if (status == 206) 
+    appendHeader(hdrLen, "Content-Range: bytes %lu-%lu/%lu\r\n", 
+      (unsigned long)start, (unsigned long)(start+len-1), (unsigned long)webFile->len);
+  if (status == 416) 
+    appendHeader(hdrLen, "Content-Range: bytes */%lu\r\n", (unsigned long)webFile->len);
+  appendHeader(hdrLen, "\r\n");
+  if (hdrLen >= (int)sizeof(fileHeader)) {
+    // truncated header would be malformed, so report error instead
+    printf("*** Header too long for %s\n", webFile->path);
+    if (sendResponsePart(esp, id, serverError)) {
+      snprintf(esp->sendBuffer, SENDBUFFERLEN, "CIPCLOSE=%s", id);
+      processATcommandOK(esp, esp->sendBuffer, 2); // close request
+    }
+    return true;
+  }
+
+  // send header then file content straight from flash
+  if (sendResponsePart(esp, id, fileHeader)) {
+    bool sendBody = (status == 200 || status == 206) && clientRequest.method == HTTP_GET;
+    if (sendBody && !sendResponseData(esp, id, webFile->data + start, len)) return true;
+    snprintf(esp->sendBuffer, SENDBUFFERLEN, "CIPCLOSE=%s", id);
+    processATcommandOK(esp, esp->sendBuffer, 2); // close request
+  }
+  return true;
 }
 
 void appResponse(const char* appResp) {
@@ -337,13 +722,57 @@ void appResponse(const char* appResp) {
   multicore_fifo_push_blocking((uintptr_t)appResp);
 }
 
-uintptr_t* webInput() {
+const webRequest_t* webInput() {
   // called from app to check web input state
+  // request content only valid until appResponse() called
+  if (webIn && !webInSeen) {
+    recordWake(webInTime);
+    webInSeen = true;
+  }
   return webIn;
 }
 
+void sleepUntilEvent(absolute_time_t wakeTime) {
+  // sleep calling core in WFE until interrupt or other event, or wake time reached
+  uint64_t sleepStart = time_us_64();
+  if (is_at_the_end_of_time(wakeTime)) __wfe();
+  else best_effort_wfe_or_timeout(wakeTime);
+  wakeStats[get_core_num()].sleepUs += time_us_64() - sleepStart;
+}
+
+static void recordWake(uint32_t eventTime) {
+  // update latency from interrupt to event being handled on calling core
+  wakeStats_t* stats = &wakeStats[get_core_num()];
+  uint32_t latency = time_us_32() - eventTime;
+  stats->wakes++;
+  stats->totalLatencyUs += latency;
+  if (latency > stats->maxLatencyUs) stats->maxLatencyUs = latency;
+}
+
+bool getWakeStats(uint core, wakeStats_t* stats) {
+  // copy wake latency and sleep time for given core
+  if (core > 1) return false;
+  *stats = wakeStats[core];
+  return true;
+}
+
+bool getESP8266stats(int espNum, espStats_t* stats) {
+  // copy health and throughput stats for given ESP8266
+  if (espNum < 0 || espNum >= ESPCOUNT) return false;
+  *stats = esps[espNum].stats;
+  return true;
+}
+
+const char* getQueryParam(const webRequest_t* request, const char* key) {
+  // return value for given query string key, or NULL if not present
+  for (int i = 0; i < request->paramCount; i++) 
+    if (strcmp(request->paramKeys[i].ptr, key) == 0) return request->paramVals[i].ptr;
+  return NULL;
+}
+
 void doRestart(const char* fatalMsg) {
   // something went wrong, so restart
+  logDrain(); // output preceding activity for calling core
   printf("*** fatal, restart in 10 secs: ");
   puts(fatalMsg);
   sleep_ms(10000);
@@ -353,159 +782,457 @@ void doRestart(const char* fatalMsg) {
 
 /* ----------------------------- Process AT commands -------------------------------- */
 
-static bool processATcommandOK(const char* command, int64_t allowTime) {
-  return processATcommand(command, allowTime, "OK");
+static bool processATcommandOK(esp8266_t* esp, const char* command, int64_t allowTime) {
+  return processATcommand(esp, command, allowTime, "OK");
 }
 
-static bool processATcommand(const char* command, int64_t allowTime, const char* successMsg) {
-  // send AT command and check response
-  allowTime *= MICROS; // convert to micro secs
-  absolute_time_t start = get_absolute_time();
-  bool runCommand = true;
-  int buffPtr = 0;
-  char sendBuffer[SENDBUFFERLEN];
-  snprintf(sendBuffer, SENDBUFFERLEN, "AT+%s\r\n", command);
+static void startATcommand(atCommand_t* at, const char* command, int64_t allowTime, const char* successMsg) {
+  // prepare AT command for sending
+  at->command = command;
+  at->successMsg = successMsg;
+  at->allowTime = allowTime * MICROS; // convert to micro secs
+  at->start = get_absolute_time();
+  at->runCommand = true;
+  at->canFail = false;
+  at->buffPtr = 0;
+  snprintf(at->atBuffer, SENDBUFFERLEN, "AT+%s\r\n", command);
+}
 
-  // loop until have required response or exceed allowed time
-  while (absolute_time_diff_us(start, get_absolute_time()) < allowTime) {
-    if (runCommand && strlen(command) > 0) {
-      // send required AT command
-      uart_puts(uart0, sendBuffer); 
-      printf("AT: %s\n", command);
-      runCommand = false;
-      buffPtr = 0;
-    }
-    buffPtr = getATdata(buffPtr);
-    if (buffPtr == -1) {
-      // abort if response is too long
-      printf("*** Response to command %s is too long: [%s]\n", command, responseBuffer);
-      return false;
-    }
+static int stepATcommand(esp8266_t* esp, atCommand_t* at) {
+  // send AT command if required and check response received so far
+  if (absolute_time_diff_us(at->start, get_absolute_time()) >= at->allowTime) return AT_TIMEOUT;
+  if (at->runCommand && strlen(at->command) > 0) {
+    // send required AT command
+    uart_puts(esp->uart, at->atBuffer); 
+    logMsg<LOG_DBG>(FMT_ATCMD, at->command, "", esp-esps);
+    at->runCommand = false;
+    at->buffPtr = 0;
+  }
+  at->buffPtr = getATdata(esp, at->buffPtr);
+  if (at->buffPtr == -1) {
+    // abort if response is too long
+    printf("*** Response to command %s is too long: [%s]\n", at->command, esp->responseBuffer);
+    return AT_FAIL;
+  }
 
-    if ((strlen(successMsg) > 0) && (strstr(responseBuffer, successMsg) != NULL)) {
-      // have required response
-      // printf("Success: [%s]\n", responseBuffer);
-      return true;
-    }
-    // expected response not found, check if busy processing
-    if (strstr(responseBuffer, "busy p...") != NULL) {
-      printf("ESP8266 busy, retry command %s\n", command);
-      sleep_ms(1000); // ESP8266 not ready for command, so retry by relooping
-      runCommand = true;
-    }
-    // ignore error due to web page being closed
-    if (strstr(responseBuffer, "link is not valid") != NULL) return false;
+  if ((strlen(at->successMsg) > 0) && (strstr(esp->responseBuffer, at->successMsg) != NULL)) {
+    // have required response
+    // printf("Success: [%s]\n", esp->responseBuffer);
+    return AT_SUCCESS;
   }
+  // expected response not found, check if busy processing
+  if (strstr(esp->responseBuffer, "busy p...") != NULL) {
+    logMsg<LOG_WARN>(FMT_ATBUSY, at->command, "", esp-esps);
+    at->runCommand = true; // ESP8266 not ready for command, so retry after delay
+    return AT_RETRY;
+  }
+  // ignore error due to web page being closed
+  if (strstr(esp->responseBuffer, "link is not valid") != NULL) return AT_FAIL;
+  if (at->canFail && strstr(esp->responseBuffer, "ERROR") != NULL) return AT_FAIL;
+  return AT_PENDING;
+}
 
+static bool endATcommand(esp8266_t* esp, atCommand_t* at) {
   // timed out, required response not found
-  if (strlen(successMsg) > 0) {
-    if (buffPtr > 0) {
-      if (strstr(responseBuffer, "link is not valid") == NULL) {// ignore error due to web page being closed
-        if (strstr(responseBuffer, "busy p...") != NULL) doRestart("Timed out waiting on ESP8266 busy");
-        if (strlen(responseBuffer) == 0) doRestart("No ESP8266 response");
-        if (strstr(responseBuffer, "busy s...") != NULL) doRestart("ESP8266 unable to receive");
-        if (strstr(responseBuffer, "ERROR") != NULL) doRestart("ESP8266 out of sync with Pico");
-        printf("*** Command %s got unexpected response: [%s]\n", command, responseBuffer);
+  if (at->canFail) return false; // remote host at fault, any ESP8266 fault found by subsequent commands
+  if (strlen(at->successMsg) > 0) {
+    if (at->buffPtr > 0) {
+      if (strstr(esp->responseBuffer, "link is not valid") == NULL) {// ignore error due to web page being closed
+        esp->stats.atErrors++;
+        if (strstr(esp->responseBuffer, "busy p...") != NULL) ESP8266failed(esp, "Timed out waiting on ESP8266 busy");
+        else if (strlen(esp->responseBuffer) == 0) ESP8266failed(esp, "No ESP8266 response");
+        else if (strstr(esp->responseBuffer, "busy s...") != NULL) ESP8266failed(esp, "ESP8266 unable to receive");
+        else if (strstr(esp->responseBuffer, "ERROR") != NULL) ESP8266failed(esp, "ESP8266 out of sync with Pico");
+        else printf("*** Command %s got unexpected response: [%s]\n", at->command, esp->responseBuffer);
       }
-    } else doRestart("Timed out waiting for ESP8266 response");
-  } else return (buffPtr > 0) ? true : false; // where successMsg is ignored
+    } else {
+      esp->stats.atErrors++;
+      ESP8266failed(esp, "Timed out waiting for ESP8266 response");
+    }
+  } else return (at->buffPtr > 0) ? true : false; // where successMsg is ignored
   return false;
 }
 
-static int getATdata(int buffPtr) {
+static bool uartReadable(void* esp) {
+  return uart_is_readable(((esp8266_t*)esp)->uart);
+}
+
+static void waitATdata(esp8266_t* esp, atCommand_t* at) {
+  // sleep until ESP8266 sends more data rather than busy polling UART
+  // UART irq is disabled on this core while AT command in progress, but as SEVONPEND is set its pending state still wakes core
+  irq_clear(esp->irq); // rearm pending state so next data generates wake event
+  if (uart_is_readable(esp->uart)) return;
+  // also wake periodically in case irq not enabled in UART, within time to fill RX FIFO
+  sleepUntilEvent(absolute_time_min(delayed_by_us(at->start, at->allowTime), make_timeout_time_us(UARTPOLLUS)));
+}
+
+static bool processATcommand(esp8266_t* esp, const char* command, int64_t allowTime, const char* successMsg) {
+  // send AT command and check response, blocking until done
+  if (!esp->stats.healthy) return false; // taken out of service
+  atCommand_t at;
+  startATcommand(&at, command, allowTime, successMsg);
+
+  // loop until have required response or exceed allowed time
+  while (true) {
+    switch (stepATcommand(esp, &at)) {
+      case AT_PENDING: waitATdata(esp, &at); break;
+      case AT_RETRY: sleep_ms(1000); break;
+      case AT_SUCCESS: return true;
+      case AT_FAIL: return false;
+      default: return endATcommand(esp, &at);
+    }
+  }
+}
+
+static picoTask<bool> processATcommandAsync(esp8266_t* esp, const char* command, int64_t allowTime, const char* successMsg, bool canFail = false) {
+  // send AT command and check response, letting other core 0 tasks run while waiting
+  if (!esp->stats.healthy) co_return false; // taken out of service
+  atCommand_t at;
+  startATcommand(&at, command, allowTime, successMsg);
+  at.canFail = canFail;
+  while (true) {
+    switch (stepATcommand(esp, &at)) {
+      case AT_PENDING: 
+        irq_clear(esp->irq); // rearm UART irq as wake event
+        co_await taskEvent(uartReadable, esp, absolute_time_min(delayed_by_us(at.start, at.allowTime), make_timeout_time_us(UARTPOLLUS)));
+        break;
+      case AT_RETRY: co_await taskSleep(1000); break;
+      case AT_SUCCESS: co_return true;
+      case AT_FAIL: co_return false;
+      default: co_return endATcommand(esp, &at);
+    }
+  }
+}
+
+static picoTask<bool> processATcommandOKAsync(esp8266_t* esp, const char* command, int64_t allowTime) {
+  co_return co_await processATcommandAsync(esp, command, allowTime, "OK");
+}
+
+static int getATdata(esp8266_t* esp, int buffPtr) {
   // obtain response from ESP8266
   bool tooLong = false;
-  while (uart_is_readable(uart0)) {
-    responseBuffer[buffPtr] = uart_getc(uart0);  // save response into buffer
+  while (uart_is_readable(esp->uart)) {
+    esp->responseBuffer[buffPtr] = uart_getc(esp->uart);  // save response into buffer
     if (buffPtr >= RESPONSEBUFFERLEN-1) tooLong = true; 
     else buffPtr++;
   }
-  responseBuffer[buffPtr] = 0; // string terminator
+  esp->responseBuffer[buffPtr] = 0; // string terminator
   return (tooLong) ? -1 : buffPtr;
 }
 
-static int getParam(int &valOffset, const char* startStr, const char* endStr) {
+static int getParam(esp8266_t* esp, int &valOffset, const char* startStr, const char* endStr) {
   // obtain location of parameter from ESP8266 AT response bounded by start and end strings
-  char* s = strstr(responseBuffer+valOffset, startStr);  
+  char* s = strstr(esp->responseBuffer+valOffset, startStr);  
   if (s == NULL) return 0;
   s += strlen(startStr); 
   char* e = strstr(s, endStr);  
   if (e == NULL) return 0;
-  valOffset = s-responseBuffer;   
+  valOffset = s-esp->responseBuffer;   
   // return length of param, and update supplied arg with offset to param
   return e-s; 
 }
 
 /* ---------------------- ESP8266 GPIO -------------------------------------- */
 
-// as GPIO routines are called from core 0, a mutex is used to prevent conflict with web server on core 1
-// so GPIO routines dont block on mutex otherwise a deadlock could occur so web server has priority
+// GPIO routines are called from core 0, so a mutex is used to prevent conflict with web server on core 1
+// they dont block on mutex otherwise a deadlock could occur, so web server has priority
 // therefore while web server is busy, gpio routines will fail
+// each is co_await'ed from core 0 tasks so that other tasks run while waiting on mutex or ESP8266 response,
+// or called as blocking version, eg during setup before tasks are spawned
 
-bool ESP8266pinMode(int pin, int direction, int pullup) {
+static int getPinValue(esp8266_t* esp) {
+  // extract pin value from response: +SYSGPIOREAD:14,0,1
+  int valOffset = 0;
+  int valLen = getParam(esp, valOffset, ",", ","); // skip over direction param
+  valOffset += valLen;
+  valLen = getParam(esp, valOffset, ",", "\r");  // final param is read value
+  char pinVal[valLen+1] = {0};
+  strncpy(pinVal, esp->responseBuffer+valOffset, valLen);
+  return atoi(pinVal);
+}
+
+static float getAdcValue(esp8266_t* esp) {
+  // extract ADC value from response: +SYSADC:<val>
+  int valOffset = 0;
+  int valLen = getParam(esp, valOffset, ":", "\r");
+  char adcVal[valLen+1] = {0};
+  strncpy(adcVal, esp->responseBuffer+valOffset, valLen); // extract value from response
+  return (float)(atoi(adcVal)/1024.0); // as a voltage 0 - 1V
+}
+
+picoTask<bool> ESP8266pinModeAsync(int pin, int direction, int pullup) {
   // define how pin to be used (configured as simple input or output, no peripherals)
   // direction: 0 for input, 1 for output
   // pullup: 1 for on, 0 for off
   // Useable: pins 4, 5, 12, 13, 14 are general purpose IO, pins 0, 2, 15 have restrictions
   // Not useable: pins 1, 3 are UART, pins 6-11 are flash, pin 16 not accessible via AT commands
+  esp8266_t* esp = &esps[0]; // GPIOs are on first ESP8266
   if (pin > 15) printf("*** Pin %u not accessible\n", pin);
   else {
-    if (mutex_enter_timeout_ms(&ESP8266mutex, MUTEXWAIT)) {
+    if (co_await taskMutexEnter(&esp->mutex, MUTEXWAIT)) {
       int mode = (pin == 1 || pin == 3 || pin > 6) ? 3 : 0; // FUNC_GPIO mode
-      snprintf(sendBuffer, SENDBUFFERLEN, "SYSIOSETCFG=%u,%u,%u", pin, mode, pullup);
-      processATcommandOK(sendBuffer, 1);  
-      snprintf(sendBuffer, SENDBUFFERLEN, "SYSGPIODIR=%u,%u", pin, direction); 
-      processATcommandOK(sendBuffer, 1); 
-      mutex_exit(&ESP8266mutex);
-      return true;
+      snprintf(esp->sendBuffer, SENDBUFFERLEN, "SYSIOSETCFG=%u,%u,%u", pin, mode, pullup);
+      co_await processATcommandOKAsync(esp, esp->sendBuffer, 1);  
+      snprintf(esp->sendBuffer, SENDBUFFERLEN, "SYSGPIODIR=%u,%u", pin, direction); 
+      co_await processATcommandOKAsync(esp, esp->sendBuffer, 1); 
+      mutex_exit(&esp->mutex);
+      co_return true;
     }
   }
-  return false; // failed to set
+  co_return false; // failed to set
 }
 
-int ESP8266digitalRead(int pin) {
+picoTask<int> ESP8266digitalReadAsync(int pin) {
   // read from ESP8266 IO pin
-  if (mutex_enter_timeout_ms(&ESP8266mutex, MUTEXWAIT)) {
-    snprintf(sendBuffer, SENDBUFFERLEN, "SYSGPIOREAD=%u", pin);
-    if (processATcommandOK(sendBuffer, 1)) {; // +SYSGPIOREAD:14,0,1
-      int valOffset = 0;
-      int valLen = getParam(valOffset, ",", ","); // skip over direction param
-      valOffset += valLen;
-      valLen = getParam(valOffset, ",", "\r");  // final param is read value
-      char pinVal[valLen+1] = {0};
-      strncpy(pinVal, responseBuffer+valOffset, valLen);
-      mutex_exit(&ESP8266mutex);
-      return atoi(pinVal); 
+  esp8266_t* esp = &esps[0]; // GPIOs are on first ESP8266
+  if (co_await taskMutexEnter(&esp->mutex, MUTEXWAIT)) {
+    snprintf(esp->sendBuffer, SENDBUFFERLEN, "SYSGPIOREAD=%u", pin);
+    if (co_await processATcommandOKAsync(esp, esp->sendBuffer, 1)) {
+      int pinVal = getPinValue(esp);
+      mutex_exit(&esp->mutex);
+      co_return pinVal; 
     }
-    mutex_exit(&ESP8266mutex);
+    mutex_exit(&esp->mutex);
   }
-  return -1; // failed to read
+  co_return -1; // failed to read
 }
 
-bool ESP8266digitalWrite(int pin, bool value) {
+picoTask<bool> ESP8266digitalWriteAsync(int pin, bool value) {
   // write to ESP8266 IO pin
-  if (mutex_enter_timeout_ms(&ESP8266mutex, MUTEXWAIT)) {
-    snprintf(sendBuffer, SENDBUFFERLEN, "SYSGPIOWRITE=%u,%u", pin, value);
-    processATcommandOK(sendBuffer, 1);  
-    mutex_exit(&ESP8266mutex);
-    return true;
+  esp8266_t* esp = &esps[0]; // GPIOs are on first ESP8266
+  if (co_await taskMutexEnter(&esp->mutex, MUTEXWAIT)) {
+    snprintf(esp->sendBuffer, SENDBUFFERLEN, "SYSGPIOWRITE=%u,%u", pin, value);
+    co_await processATcommandOKAsync(esp, esp->sendBuffer, 1);  
+    mutex_exit(&esp->mutex);
+    co_return true;
   }
-  return false; // failed to write
+  co_return false; // failed to write
 }
 
-float ESP8266analogRead() {
+picoTask<float> ESP8266analogReadAsync() {
   // read value from single analog pin and return as voltage
-  if (mutex_enter_timeout_ms(&ESP8266mutex, MUTEXWAIT)) {
-    if (processATcommandOK("SYSADC?", 1)) {
-      int valOffset = 0;
-      int valLen = getParam(valOffset, ":", "\r");
-      char adcVal[valLen+1] = {0};
-      strncpy(adcVal, responseBuffer+valOffset, valLen); // extract value from response
-      mutex_exit(&ESP8266mutex);
-      return (float)(atoi(adcVal)/1024.0); // as a voltage 0 - 1V
+  esp8266_t* esp = &esps[0]; // GPIOs are on first ESP8266
+  if (co_await taskMutexEnter(&esp->mutex, MUTEXWAIT)) {
+    if (co_await processATcommandOKAsync(esp, "SYSADC?", 1)) {
+      float adcVal = getAdcValue(esp);
+      mutex_exit(&esp->mutex);
+      co_return adcVal;
     }
-    mutex_exit(&ESP8266mutex);
+    mutex_exit(&esp->mutex);
   } 
-  return -1.0; // failed to read
+  co_return -1.0; // failed to read
+}
+
+template <typename T>
+static picoTask<> storeResult(picoTask<T> task, T* result, bool* done) {
+  *result = co_await task;
+  *done = true;
+}
+
+template <typename T>
+static T runBlocking(picoTask<T> task) {
+  // run task to completion for blocking caller on core 0, which must not itself be a task
+  // any other waiting tasks are also run meanwhile
+  T result{};
+  bool done = false;
+  std::coroutine_handle<> handle = storeResult(std::move(task), &result, &done).release();
+  handle.resume(); // runs until first suspension, then resumed by scheduler
+  while (!done) if (!runTasks()) sleepUntilEvent(taskNextWake());
+  handle.destroy();
+  return result;
+}
+
+bool ESP8266pinMode(int pin, int direction, int pullup) {
+  return runBlocking(ESP8266pinModeAsync(pin, direction, pullup));
+}
+
+int ESP8266digitalRead(int pin) {
+  return runBlocking(ESP8266digitalReadAsync(pin));
 }
 
+bool ESP8266digitalWrite(int pin, bool value) {
+  return runBlocking(ESP8266digitalWriteAsync(pin, value));
+}
+
+float ESP8266analogRead() {
+  return runBlocking(ESP8266analogReadAsync());
+}
+
+/* ---------------------- Outbound telemetry from core 0 -------------------------------------- */
+
+// samples are buffered in a ring on core 0 and sent in batches as CSV lines: <id>,<ms since boot>,<value>
+// each batch uses one CIPSTART / CIPSEND / CIPCLOSE sequence on a spare link id, rather than a client polling per sample
+// only accessed from core 0 tasks, so no locking needed
+
+typedef struct {
+  uint32_t time; // ms since boot
+  uint16_t id;
+  float value;
+} telemetrySample_t;
+
+#define TELEMETRYHDRLEN 200 // space for HTTP POST header
+#define TELEMETRYLINELEN 32 // max length of CSV line for a sample
+
+static_assert(TELEMETRYHDRLEN + TELEMETRYBATCH * TELEMETRYLINELEN <= 2048, "TELEMETRYBATCH too large for ESP8266 CIPSEND max of 2048 bytes");
+
+enum {TELEMETRY_SENT, TELEMETRY_BUSY, TELEMETRY_FAILED}; // outcome of sending batch
+
+static telemetrySample_t telemetryRing[TELEMETRYRINGLEN];
+static uint32_t telemetryHead = 0; // next sample to write
+static uint32_t telemetryTail = 0; // oldest unsent sample
+static telemetryStats_t telemetryStats;
+static char telemetryBuffer[TELEMETRYHDRLEN + TELEMETRYBATCH * TELEMETRYLINELEN]; // batch payload sent by DMA
+
+void telemetryAdd(uint16_t id, float value) {
+  // buffer sample for next batch, overwriting oldest if full
+  if (telemetryHead - telemetryTail >= TELEMETRYRINGLEN) {
+    telemetryTail++;
+    telemetryStats.dropped++;
+  }
+  telemetryRing[telemetryHead++ % TELEMETRYRINGLEN] = {to_ms_since_boot(get_absolute_time()), id, value};
+  telemetryStats.samples++;
+}
+
+void getTelemetryStats(telemetryStats_t* stats) {
+  *stats = telemetryStats;
+}
+
+static bool telemetryPending(void* arg) {
+  return telemetryHead != telemetryTail;
+}
+
+static bool telemetryBatchFull(void* arg) {
+  return telemetryHead - telemetryTail >= TELEMETRYBATCH;
+}
+
+static int buildTelemetry(uint32_t batchStart, int &batchLen) {
+  // format batch of samples into telemetryBuffer, returns payload length
+  // batchLen is reduced if samples dont fit
+  char* body = telemetryBuffer + TELEMETRYHDRLEN;
+  int bodySize = sizeof(telemetryBuffer) - TELEMETRYHDRLEN;
+  int bodyLen = 0;
+  for (int i = 0; i < batchLen; i++) {
+    telemetrySample_t* sample = &telemetryRing[(batchStart + i) % TELEMETRYRINGLEN];
+    int lineLen = snprintf(body+bodyLen, bodySize-bodyLen, "%u,%lu,%0.3f\n", sample->id, (unsigned long)sample->time, sample->value);
+    if (lineLen >= bodySize-bodyLen) {
+      body[bodyLen] = 0; // remove partial line, remaining samples sent in next batch
+      batchLen = i;
+      break;
+    }
+    bodyLen += lineLen;
+  }
+  // UDP datagram is just the CSV lines, otherwise precede with HTTP POST header
+  int hdrLen = TELEMETRYUDP ? 0 : snprintf(telemetryBuffer, TELEMETRYHDRLEN, 
+    "POST %s HTTP/1.1\r\nHost: %s:%u\r\nContent-Type: text/csv\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", 
+    TELEMETRYPATH, TELEMETRYHOST, TELEMETRYPORT, bodyLen);
+  memmove(telemetryBuffer+hdrLen, body, bodyLen);
+  return hdrLen + bodyLen;
+}
+
+static int strayClient(esp8266_t* esp) {
+  // link id of any web client that connected or sent request while telemetry read ESP8266 output, or -1
+  for (const char* p = esp->responseBuffer; (p = strstr(p, "+IPD,")) != NULL; p++) 
+    if (isdigit(p[5]) && p[5] - '0' != TELEMETRYLINK) return p[5] - '0';
+  const char* connected = clientLinkEvent(esp, ",CONNECT");
+  return (connected != NULL) ? connected[-1] - '0' : -1;
+}
+
+static picoTask<int> sendTelemetry() {
+  // send oldest batch of samples to collector via first serving ESP8266
+  // as all ESP8266 output is read here until done, only started while no web client link is open
+  esp8266_t* esp = NULL;
+  for (esp8266_t* e = esps; e < esps+ESPCOUNT; e++) {
+    if (e->stats.serving) {
+      esp = e;
+      break;
+    }
+  }
+  if (esp == NULL || clientLinkOpen(esp) || !co_await taskMutexEnter(&esp->mutex, MUTEXWAIT)) co_return TELEMETRY_BUSY;
+  if (clientLinkOpen(esp)) {
+    // client connected while waiting on mutex
+    mutex_exit(&esp->mutex);
+    co_return TELEMETRY_BUSY;
+  }
+
+  uint32_t batchStart = telemetryTail;
+  int batchLen = (telemetryHead - telemetryTail < TELEMETRYBATCH) ? telemetryHead - telemetryTail : TELEMETRYBATCH;
+  int payloadLen = buildTelemetry(batchStart, batchLen);
+  int result = TELEMETRY_FAILED;
+  char linkData[12];
+  snprintf(linkData, sizeof(linkData), "+IPD,%u,", TELEMETRYLINK);
+
+  // collector being unreachable is expected, so dont treat AT errors as ESP8266 fault
+  snprintf(esp->sendBuffer, SENDBUFFERLEN, "CIPSTART=%u,\"%s\",\"%s\",%u", TELEMETRYLINK, TELEMETRYUDP ? "UDP" : "TCP", TELEMETRYHOST, TELEMETRYPORT);
+  bool stepOK = co_await processATcommandAsync(esp, esp->sendBuffer, 5, "OK", true);
+  int client = strayClient(esp);
+  if (stepOK && client < 0) {
+    snprintf(esp->sendBuffer, SENDBUFFERLEN, "CIPSEND=%u,%d", TELEMETRYLINK, payloadLen);
+    stepOK = co_await processATcommandAsync(esp, esp->sendBuffer, 2, ">", true);
+    client = strayClient(esp);
+    if (stepOK && client < 0) {
+      writeUartData(esp, telemetryDma, (const uint8_t*)telemetryBuffer, payloadLen);
+      // UDP sent once ESP8266 confirms, HTTP once collector replies with 2xx: +IPD,<link>,<len>:HTTP/1.1 200 OK
+      stepOK = co_await processATcommandAsync(esp, "", 5, TELEMETRYUDP ? "SEND OK" : linkData, true);
+      if (telemetryDma >= 0) dma_channel_wait_for_finish_blocking(telemetryDma);
+      if (stepOK && !TELEMETRYUDP) {
+        co_await taskSleep(10); // rest of status line follows in same burst
+        getATdata(esp, strlen(esp->responseBuffer));
+        const char* status = strstr(esp->responseBuffer, linkData);
+        if (status != NULL) status = strstr(status, ":HTTP/1.");
+        stepOK = status != NULL && status[10] == '2';
+      }
+      client = strayClient(esp);
+      if (stepOK) result = TELEMETRY_SENT;
+    }
+  }
+  if (client >= 0) {
+    // request was read here so cannot be serviced, close it rather than leave it blocking the web server
+    snprintf(esp->sendBuffer, SENDBUFFERLEN, "CIPCLOSE=%d", client);
+    co_await processATcommandAsync(esp, esp->sendBuffer, 2, "OK", true);
+    if (result != TELEMETRY_SENT) result = TELEMETRY_BUSY;
+  }
+  // close telemetry link, error response if already closed by collector
+  // allows for ESP8266 still busy with connection attempt after CIPSTART given up
+  snprintf(esp->sendBuffer, SENDBUFFERLEN, "CIPCLOSE=%u", TELEMETRYLINK);
+  co_await processATcommandAsync(esp, esp->sendBuffer, 5, "OK", true);
+  mutex_exit(&esp->mutex);
+
+  if (result == TELEMETRY_SENT) {
+    // remove sent samples, unless already overwritten meanwhile
+    uint32_t batchEnd = batchStart + batchLen;
+    if ((int32_t)(batchEnd - telemetryTail) > 0) telemetryTail = batchEnd;
+    telemetryStats.batches++;
+    telemetryStats.sent += batchLen;
+  }
+  co_return result;
+}
+
+picoTask<> telemetryTask() {
+  // send buffered samples when batch is full or oldest sample reaches max age
+  // backs off exponentially while collector is unreachable, samples continue to be buffered
+  uint32_t backoffSecs = 0;
+  while (true) {
+    if (telemetryHead == telemetryTail) co_await taskEvent(telemetryPending);
+    uint32_t oldestAge = to_ms_since_boot(get_absolute_time()) - telemetryRing[telemetryTail % TELEMETRYRINGLEN].time;
+    if (oldestAge < TELEMETRYAGE * 1000) 
+      co_await taskEvent(telemetryBatchFull, nullptr, make_timeout_time_ms(TELEMETRYAGE * 1000 - oldestAge));
+
+    switch (co_await sendTelemetry()) {
+      case TELEMETRY_SENT: 
+        backoffSecs = 0; 
+        break;
+      case TELEMETRY_BUSY: 
+        // ESP8266 in use by web client, retry shortly without backing off
+        telemetryStats.deferred++;
+        logMsg<LOG_DBG>(FMT_TELEMETRY, "deferred as ESP8266 busy", "", 1);
+        co_await taskSleep(1000);
+        break;
+      default:
+        telemetryStats.failures++;
+        backoffSecs = (backoffSecs == 0) ? 1 : (backoffSecs * 2 > TELEMETRYBACKOFF) ? TELEMETRYBACKOFF : backoffSecs * 2;
+        logMsg<LOG_WARN>(FMT_TELEMETRY, "batch not sent", "", backoffSecs);
+        co_await taskSleep(backoffSecs * 1000);
+        break;
+    }
+  }
+}
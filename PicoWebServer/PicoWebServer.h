@@ -4,25 +4,100 @@
 #ifndef ESPWEBSERVER
 #define ESPWEBSERVER
 
+#include "PicoTask.h"
+
 // user defined values
 #define WIFISSID "****" // wifi SSID
 #define WIFIPASS "****" // wifi password
 #define STATICIP "192.168.1.135" // static IP for PicoWebServer
+#define STATICIP2 "192.168.1.136" // static IP for second ESP8266 if ESP8266MODE is 1
 #define GATEWAY "192.168.1.1" // gateway (eg router)
 #define TIMEZOME 0 // +/- local time offset in hours from UTC
 
 // usr modifiable
 #define RESETPIN 2  // Pico pin used to connect to ESP8266 RST
+#define RESETPIN2 6  // Pico pin used to connect to second ESP8266 RST
+#define ESP8266MODE 0 // 0: single ESP8266 on uart0, 1: second ESP8266 on uart1 with own IP, 2: second ESP8266 on uart1 as standby for first
 #define BLINKRATE 1 // in secs (can be fraction)
 #define MUTEXWAIT 100 // time in ms for ESP8266 gpio functions to wait on mutex
 #define NTPRETRIES 5 // max attempts to get current time from NTP
 #define RESPONSEBUFFERLEN 1000 // size of buffer to receive data from web client(max 2048)
-#define SENDBUFFERLEN 500 // size of buffer to send data to web client (max 2048)
+#define SENDBUFFERLEN 500 // size of buffer for AT commands sent to ESP8266
+#define SENDCHUNKLEN 2048 // max size of each data packet sent to web client (max 2048)
+#define UARTPOLLUS 1000 // max sleep in micro secs while waiting on ESP8266 response, less than time to fill UART RX FIFO
+#define CLIENTTIMEOUT 180 // secs before ESP8266 server closes idle web client link (CIPSTO)
+#define MAXQUERYPARAMS 8 // max number of query string parameters extracted from request URL
+#define LOGLEVEL 3 // max level of deferred logging compiled in: 0 error, 1 warning, 2 info, 3 debug (AT commands)
+
+// outbound telemetry, see README
+#define TELEMETRYHOST "192.168.1.100" // IP of collector receiving telemetry batches
+#define TELEMETRYPORT 8080 // collector port
+#define TELEMETRYUDP false // true: send each batch as UDP datagram, false: as HTTP POST
+#define TELEMETRYPATH "/telemetry" // URL path for HTTP POST
+#define TELEMETRYLINK 4 // ESP8266 link id for telemetry connection, not used by web server as only one client connection
+#define TELEMETRYRINGLEN 128 // max samples buffered on core 0, oldest dropped when full
+#define TELEMETRYBATCH 32 // send batch when this many samples buffered
+#define TELEMETRYAGE 10 // or when oldest buffered sample is this many secs old
+#define TELEMETRYBACKOFF 60 // max secs to wait before retrying when collector unreachable
+
+#define ESPCOUNT ((ESP8266MODE == 0) ? 1 : 2) // number of connected ESP8266
+
+// health and throughput for each ESP8266
+typedef struct {
+  bool healthy; // responding to AT commands
+  bool serving; // web server started
+  uint32_t requests; // web client requests received
+  uint32_t bytesSent; // response data sent to web clients
+  uint32_t atErrors; // AT commands failed or timed out
+  uint32_t outages; // times taken out of service
+} espStats_t;
+
+// wake from sleep on each core
+typedef struct {
+  uint32_t wakes; // events handled after interrupt
+  uint32_t maxLatencyUs; // max time from interrupt to event being handled
+  uint64_t totalLatencyUs; // for average latency
+  uint64_t sleepUs; // total time in WFE
+} wakeStats_t;
+
+// outbound telemetry progress
+typedef struct {
+  uint32_t samples; // samples added
+  uint32_t dropped; // samples overwritten before sent
+  uint32_t batches; // batches accepted by collector
+  uint32_t sent; // samples in accepted batches
+  uint32_t failures; // batches not accepted, retried after backoff
+  uint32_t deferred; // batches delayed as ESP8266 busy with web client
+} telemetryStats_t;
 
 // used for ESP8266 gpio 
 enum {ESP_INPUT, ESP_OUTPUT};  // ESP8266 pin direction
 enum {ESP_PULLUP, ESP_NOPULLUP}; // ESP8266 pin pullup
 
+// web client request, parsed once on core 1 and passed to core 0
+enum httpMethod {HTTP_GET, HTTP_POST, HTTP_HEAD, HTTP_PUT, HTTP_DELETE, HTTP_OTHER};
+
+typedef struct {
+  // view into receive buffer, terminated in place so can also be used as a string
+  const char* ptr;
+  int len;
+} strView_t;
+
+typedef struct {
+  // all views are empty strings if not present in request
+  httpMethod method;
+  strView_t path; // percent decoded, excludes query string
+  int paramCount;
+  strView_t paramKeys[MAXQUERYPARAMS]; // percent decoded query string keys
+  strView_t paramVals[MAXQUERYPARAMS]; // percent decoded query string values
+  strView_t ifNoneMatch;
+  strView_t range;
+  strView_t acceptEncoding;
+  strView_t contentType;
+  int contentLength; // -1 if not present
+  strView_t body;
+} webRequest_t;
+
 #define MICROS 1000000 // microseconds per sec
 extern char datetimeStr[]; // holds current RTC time
 
@@ -33,11 +108,22 @@ bool startWebServer();
 void serveClients();
 void appResponse(const char* appResp);
 void doRestart(const char* fatalMsg);
-uintptr_t* webInput();
+const webRequest_t* webInput();
+const char* getQueryParam(const webRequest_t* request, const char* key);
 void getTOD();
 bool ESP8266pinMode(int pin, int direction, int pullup);
 int ESP8266digitalRead(int pin);
 bool ESP8266digitalWrite(int pin, bool value);
 float ESP8266analogRead();
+picoTask<bool> ESP8266pinModeAsync(int pin, int direction, int pullup);
+picoTask<int> ESP8266digitalReadAsync(int pin);
+picoTask<bool> ESP8266digitalWriteAsync(int pin, bool value);
+picoTask<float> ESP8266analogReadAsync();
+bool getESP8266stats(int espNum, espStats_t* stats);
+void sleepUntilEvent(absolute_time_t wakeTime);
+bool getWakeStats(uint core, wakeStats_t* stats);
+void telemetryAdd(uint16_t id, float value);
+picoTask<> telemetryTask();
+void getTelemetryStats(telemetryStats_t* stats);
 
 #endif
\ No newline at end of file
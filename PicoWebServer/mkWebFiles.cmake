@@ -0,0 +1,77 @@
+# Generates source file holding content of each file in DATA_DIR as a flash resident array,
+# with an index of web path, content type, length and hash for each file.
+# Run as: cmake -DDATA_DIR=<dir> -DOUTPUT=<file> -P mkWebFiles.cmake
+# s60sc 2021
+
+file(GLOB_RECURSE dataFiles RELATIVE ${DATA_DIR} ${DATA_DIR}/*)
+list(SORT dataFiles)
+set(fileArrays "")
+set(fileIndex "")
+set(fileNum 0)
+
+foreach(dataFile ${dataFiles})
+  # file content as hex bytes
+  file(READ ${DATA_DIR}/${dataFile} hexData HEX)
+  string(LENGTH "${hexData}" hexLen)
+  math(EXPR fileLen "${hexLen} / 2")
+  if(fileLen EQUAL 0)
+    set(hexData "0x00,")
+  else()
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," hexData "${hexData}")
+  endif()
+
+  # first 32 bits of content SHA1 used as ETag
+  file(SHA1 ${DATA_DIR}/${dataFile} fileHash)
+  string(SUBSTRING ${fileHash} 0 8 fileHash)
+
+  # content type from file extension
+  string(REGEX MATCH "[^.]*$" fileExt ${dataFile})
+  string(TOLOWER "${fileExt}" fileExt)
+  if(fileExt STREQUAL "html" OR fileExt STREQUAL "htm")
+    set(contentType "text/html")
+  elseif(fileExt STREQUAL "js")
+    set(contentType "application/javascript")
+  elseif(fileExt STREQUAL "css")
+    set(contentType "text/css")
+  elseif(fileExt STREQUAL "json")
+    set(contentType "application/json")
+  elseif(fileExt STREQUAL "txt" OR fileExt STREQUAL "csv")
+    set(contentType "text/plain")
+  elseif(fileExt STREQUAL "svg")
+    set(contentType "image/svg+xml")
+  elseif(fileExt STREQUAL "png")
+    set(contentType "image/png")
+  elseif(fileExt STREQUAL "jpg" OR fileExt STREQUAL "jpeg")
+    set(contentType "image/jpeg")
+  elseif(fileExt STREQUAL "gif")
+    set(contentType "image/gif")
+  elseif(fileExt STREQUAL "ico")
+    set(contentType "image/x-icon")
+  elseif(fileExt STREQUAL "gz")
+    set(contentType "application/gzip")
+  else()
+    set(contentType "application/octet-stream")
+  endif()
+
+  string(APPEND fileArrays "static const uint8_t __in_flash(\"webfiles\") webFile${fileNum}[] = {${hexData}};\n")
+  string(APPEND fileIndex "  {\"/${dataFile}\", \"${contentType}\", webFile${fileNum}, ${fileLen}, 0x${fileHash}},\n")
+  math(EXPR fileNum "${fileNum} + 1")
+endforeach()
+
+if(fileNum EQUAL 0)
+  set(fileIndex "  {\"\", \"\", NULL, 0, 0},\n") # placeholder as no files
+endif()
+
+file(WRITE ${OUTPUT}.tmp "// generated by mkWebFiles.cmake from ${DATA_DIR}, do not edit
+
+#include \"pico/stdlib.h\"
+#include \"PicoWSfiles.h\"
+
+${fileArrays}
+const webFile_t webFiles[] = {
+${fileIndex}};
+const int webFileCount = ${fileNum};
+")
+# only replace if changed to avoid needless rebuilds
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different ${OUTPUT}.tmp ${OUTPUT})
+file(REMOVE ${OUTPUT}.tmp)